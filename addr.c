@@ -0,0 +1,34 @@
+/*
+ * Address buckets, see addr.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addr.h"
+
+struct addr_bins addr_bins = { 256 };
+
+int addr_bins_load(const char *path)
+{
+    char (*names)[LPM_NAME_LEN];
+    int n;
+
+    if ((n = lpm_read(&addr_bins.lpm, path, 1, ADDR_MAX_BINS - 1, &names)) < 0)
+        return -1;
+
+    if ((addr_bins.names = calloc(n + 1, sizeof(*names))) == NULL)
+    {
+        fprintf(stderr, "ERROR! addr: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(addr_bins.names[0], "other");
+    memcpy(addr_bins.names + 1, names, n*sizeof(*names));
+    free(names);
+
+    addr_bins.nbins = n + 1;
+
+    return 0;
+}
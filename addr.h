@@ -0,0 +1,46 @@
+#ifndef ADDR_H
+#define ADDR_H
+
+/*
+ * Address buckets for the source and destination address features.
+ *
+ * By default an address counts in the bucket of its last octet.  With a
+ * prefix file (HBTAD_ADDR_PREFIXES, same format as the tenants file) each
+ * line is a named group of prefixes, e.g.
+ *
+ *     internal   10.0.0.0/8 172.16.0.0/12
+ *     cloud      3.0.0.0/8 52.0.0.0/8
+ *     bogon      0.0.0.0/8 127.0.0.0/8 240.0.0.0/4
+ *
+ * and an address counts in the bucket of the group with the longest
+ * matching prefix, bucket 0 holding everything that matches none.  The
+ * lookup is the DIR-24-8 table from lpm.h, one or two loads per address.
+ */
+
+#include <stdint.h>
+
+#include "lpm.h"
+
+// buckets the histograms have room for, group 0 is "other"
+#define ADDR_MAX_BINS 256
+
+struct addr_bins {
+    int nbins;
+    struct lpm lpm;                     // prefix -> bucket, unused for octets
+    char (*names)[LPM_NAME_LEN];        // of the buckets, NULL for octets
+};
+
+extern struct addr_bins addr_bins;
+
+// read the prefix groups, 0 on success
+int addr_bins_load(const char *path);
+
+static inline int addr_bin(uint32_t addr)
+{
+    if (!addr_bins.names)
+        return addr & 0xff;
+
+    return lpm_lookup(&addr_bins.lpm, addr);
+}
+
+#endif
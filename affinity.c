@@ -0,0 +1,132 @@
+/*
+ * Thread pinning and memory placement, see affinity.h.
+ */
+
+#define _GNU_SOURCE             // pthread_setaffinity_np(), sched_getcpu()
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+
+#include "config.h"
+#include "affinity.h"
+
+static int capture_pinned;
+static cpu_set_t capture_mask;
+
+void affinity_pin(const char *who, int cpu)
+{
+    cpu_set_t set;
+
+    // started from the pinned capture thread, but free to run anywhere
+    if (cpu < 0)
+    {
+        if (capture_pinned)
+            pthread_setaffinity_np(pthread_self(), sizeof(capture_mask), &capture_mask);
+        return;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "warning: affinity: unable to pin %s to cpu %d\n", who, cpu);
+}
+
+void affinity_capture_start(void)
+{
+    capture_pinned = capture.cpu_capture >= 0
+        && pthread_getaffinity_np(pthread_self(), sizeof(capture_mask), &capture_mask) == 0;
+    affinity_pin("capture", capture.cpu_capture);
+}
+
+void affinity_capture_stop(void)
+{
+    if (capture_pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(capture_mask), &capture_mask);
+    capture_pinned = 0;
+}
+
+#ifdef HAVE_NUMA
+// more than one node to choose from
+static int numa_useful(void)
+{
+    static int useful = -1;
+
+    if (useful < 0)
+        useful = numa_available() >= 0 && numa_max_node() > 0;
+    return useful;
+}
+#endif
+
+int affinity_node(int cpu)
+{
+#ifdef HAVE_NUMA
+    int node;
+
+    if (!numa_useful())
+        return 0;
+    if (cpu < 0 && (cpu = sched_getcpu()) < 0)
+        return 0;
+    return (node = numa_node_of_cpu(cpu)) < 0 ? 0 : node;
+#else
+    (void)cpu;
+    return 0;
+#endif
+}
+
+// what a mapping of size bytes really takes
+static size_t alloc_len(size_t size)
+{
+    size_t page = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+
+    return (size + page - 1) & ~(page - 1);
+}
+
+void *affinity_alloc(size_t size, int node)
+{
+    static int warned;
+    size_t len = alloc_len(size);
+    int huge = capture.hugepages && size >= HUGE_PAGE_SIZE;
+    void *p = MAP_FAILED;
+
+    if (huge)
+    {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED && !warned)
+        {
+            fprintf(stderr, "warning: affinity: no reserved huge pages left, "
+                    "using transparent ones\n");
+            warned = 1;
+        }
+    }
+    if (p == MAP_FAILED)
+    {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        if (huge)
+            madvise(p, len, MADV_HUGEPAGE);
+    }
+
+#ifdef HAVE_NUMA
+    // before anything touches the pages
+    if (numa_useful())
+        numa_tonode_memory(p, len, node < 0 ? affinity_node(-1) : node);
+#else
+    (void)node;
+#endif
+
+    return p;
+}
+
+void affinity_free(void *p, size_t size)
+{
+    if (p)
+        munmap(p, alloc_len(size));
+}
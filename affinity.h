@@ -0,0 +1,53 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+/*
+ * Where threads run and where their memory lives.
+ *
+ * Threads are pinned to cores with the cpu_* settings in capture (see
+ * config.h): the capture thread, the pipeline stages and the parallel
+ * file readers.  The capture thread's own mask is put back once the
+ * capture is over, so the training after it isn't held to one core.
+ *
+ * Memory that one thread works on (histogram shards, pipeline queues,
+ * window history) is asked for from the NUMA node the thread runs on.
+ * With libnuma (make HAVE_NUMA=1) the pages are bound to that node before
+ * they are touched.  Without it, or on a single node, they land wherever
+ * they are first written to, which is the owning thread when it allocates
+ * for itself.
+ *
+ * Allocations of 2 MB and up are backed by huge pages with hugepages = 1,
+ * which saves TLB misses on tables that are read all over, like the
+ * prefix table and the window history.  Reserved huge pages
+ * (vm.nr_hugepages) are used first; when there are none left the mapping
+ * falls back to transparent huge pages, which the kernel may or may not
+ * provide.
+ */
+
+#include <stddef.h>
+
+// a huge page, and the size from which allocations use them
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+// pin the calling thread to cpu.  For cpu < 0 it may run anywhere the
+// capture thread could before it was pinned.  who names the thread in the
+// warning if pinning fails
+void affinity_pin(const char *who, int cpu);
+
+// pin the calling thread to capture.cpu_capture for a capture, and put its
+// old mask back after
+void affinity_capture_start(void);
+void affinity_capture_stop(void);
+
+// the NUMA node of cpu, or of the calling thread for cpu < 0.  0 when not
+// known
+int affinity_node(int cpu);
+
+// size bytes of zeroed, page aligned memory on node, -1 for the calling
+// thread's.  NULL if out of memory
+void *affinity_alloc(size_t size, int node);
+
+// free memory from affinity_alloc(), size as it was allocated with
+void affinity_free(void *p, size_t size);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Region allocator, see arena.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affinity.h"
+#include "arena.h"
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;                    // of the whole block
+    size_t used;                    // of data
+    _Alignas(64) char data[];
+};
+
+static __thread struct arena scratch;
+
+static size_t block_room(const struct arena_block *b)
+{
+    return b->size - sizeof(*b);
+}
+
+// a new block for at least size bytes, after the current one
+static struct arena_block *arena_grow(struct arena *a, size_t size)
+{
+    struct arena_block *b, *cur = a->cur;
+    size_t bytes = cur ? 2*cur->size : ARENA_MIN_BLOCK;
+
+    if (bytes > HUGE_PAGE_SIZE)
+        bytes = HUGE_PAGE_SIZE;
+    if (bytes < sizeof(*b) + size)
+        bytes = sizeof(*b) + size;
+
+    if ((b = affinity_alloc(bytes, -1)) == NULL)
+    {
+        fprintf(stderr, "ERROR! arena: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    b->size = bytes;
+
+    if (cur)
+    {
+        b->next = cur->next;
+        cur->next = b;
+    }
+    else
+    {
+        b->next = a->first;
+        a->first = b;
+    }
+
+    return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_block *b = a->cur;
+    size_t at;
+
+    size = (size + 63) & ~(size_t)63;
+
+    if (!b || b->used + size > block_room(b))
+    {
+        // the spare block after this one, unless it is too small
+        b = b ? b->next : a->first;
+        if (b && size <= block_room(b))
+            b->used = 0;
+        else
+            b = arena_grow(a, size);
+        a->cur = b;
+    }
+
+    at = b->used;
+    b->used += size;
+
+    return b->data + at;
+}
+
+void *arena_zalloc(struct arena *a, size_t size)
+{
+    return memset(arena_alloc(a, size), 0, size);
+}
+
+struct arena_mark arena_mark(struct arena *a)
+{
+    struct arena_mark m = { a->cur, a->cur ? a->cur->used : 0 };
+
+    return m;
+}
+
+void arena_release(struct arena *a, struct arena_mark m)
+{
+    a->cur = m.block;
+    if (m.block)
+        m.block->used = m.used;
+}
+
+void arena_reset(struct arena *a)
+{
+    a->cur = NULL;
+}
+
+void arena_free(struct arena *a)
+{
+    struct arena_block *b;
+
+    while ((b = a->first) != NULL)
+    {
+        a->first = b->next;
+        affinity_free(b, b->size);
+    }
+    a->cur = NULL;
+}
+
+size_t arena_held(const struct arena *a)
+{
+    const struct arena_block *b;
+    size_t n = 0;
+
+    for (b = a->first; b; b = b->next)
+        n += b->size;
+
+    return n;
+}
+
+struct arena *arena_scratch(void)
+{
+    return &scratch;
+}
@@ -0,0 +1,63 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ * Region allocator.
+ *
+ * An arena hands out memory by bumping a pointer through a chain of
+ * blocks, and gives it all back at once.  Nothing is freed on its own.
+ * Resetting, or going back to a mark taken earlier, only moves the
+ * pointer, so it is O(1) however much was allocated.  The blocks are
+ * kept and used again, so an arena that is reset for every training run
+ * or window grows to its peak once and then stops asking for memory.
+ *
+ * Blocks double from ARENA_MIN_BLOCK up to a huge page (see affinity.h);
+ * a larger allocation gets a block of its own size.  They come from
+ * affinity_alloc(), on the NUMA node of the thread that grows the arena.
+ *
+ * A zeroed struct arena is an empty arena, ready for use.
+ *
+ * Each thread also has a scratch arena for memory that doesn't outlive a
+ * call.  Take a mark on the way in and release it on the way out, then
+ * calls can nest.
+ */
+
+#include <stddef.h>
+
+// the first block
+#define ARENA_MIN_BLOCK (64 << 10)
+
+struct arena_block;
+
+struct arena {
+    struct arena_block *first;
+    struct arena_block *cur;        // being carved, blocks after it are spare
+};
+
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+// size bytes, 64 byte aligned.  arena_alloc() leaves them as they were,
+// arena_zalloc() zeroes them.  Both exit when out of memory
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_zalloc(struct arena *a, size_t size);
+
+// where the arena is now, and going back there
+struct arena_mark arena_mark(struct arena *a);
+void arena_release(struct arena *a, struct arena_mark m);
+
+// everything allocated is gone, the blocks are kept
+void arena_reset(struct arena *a);
+
+// the blocks too
+void arena_free(struct arena *a);
+
+// bytes of blocks the arena holds
+size_t arena_held(const struct arena *a);
+
+// the calling thread's scratch arena
+struct arena *arena_scratch(void);
+
+#endif
@@ -0,0 +1,583 @@
+/*
+ * Throughput benchmark for hbtad.
+ *
+ * Generates synthetic traffic in memory and times each stage of the
+ * detector on it:
+ *
+ *   parse     got_packet() over every packet (parse + histogram update)
+ *   fit       learning the metric space mapping from the windows
+ *   project   mapping every window into the metric space
+ *   distance  distance() between every window vector and every centroid
+ *   assign    the same pairs as one kmeans_assign() sweep (a matrix multiply
+ *             for euclid)
+ *   kmeans    kmeans() over all window vectors
+ *   classify  classify() of every window vector against the centroids
+ *
+ * Everything is driven by a seeded PRNG so runs are reproducible.  The
+ * generated traffic can also be written out as a pcap file with -w to feed
+ * it to hbtad itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hbtad.h"
+#include "output.h"
+#include "stats.h"
+#include "hist.h"
+#include "bins.h"
+#include "proj.h"
+#include "distance.h"
+#include "matrix.h"
+
+// bytes of each synthetic packet that are kept, like a capture snaplen
+#define BENCH_SNAP 128
+
+struct bench_opts {
+    long num_packets;
+    int passes;
+    unsigned long seed;
+    int pct_tcp, pct_udp, pct_icmp;     // rest is other IP protocols
+    int min_size, max_size;
+    int imix;
+    double addr_zipf;                   // 0 means uniform
+    double well_known;                  // fraction of ports in 0-1023
+    double vlan;                        // fraction of 802.1Q tagged frames
+    double malformed;                   // fraction of broken headers
+    int num_windows;
+    int num_clusters;
+    long pps;                           // capture time the packets span
+    const char *pcap_out;
+};
+
+struct bench_pkt {
+    struct pcap_pkthdr hdr;
+    u_char *data;
+};
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double rng_unit(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(int lo, int hi)
+{
+    return lo + (int)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+// cumulative distribution over n ranks with weight 1/(r+1)^s
+static double *zipf_cdf(int n, double s)
+{
+    double *cdf = malloc(n*sizeof(double));
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        sum += (s > 0) ? 1.0/pow(i + 1, s) : 1.0;
+        cdf[i] = sum;
+    }
+
+    for (i = 0; i < n; i++)
+        cdf[i] /= sum;
+
+    return cdf;
+}
+
+static int zipf_draw(const double *cdf, int n)
+{
+    double u = rng_unit();
+    int lo = 0, hi = n - 1, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi)/2;
+        if (cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void put16(u_char *p, int v)
+{
+    p[0] = (v >> 8) & 0xff;
+    p[1] = v & 0xff;
+}
+
+static int draw_size(const struct bench_opts *o)
+{
+    int r;
+
+    if (o->imix)
+    {
+        // simple IMIX, 7:4:1
+        r = rng_range(0, 11);
+        if (r < 7)
+            return 64;
+        if (r < 11)
+            return 576;
+        return 1500;
+    }
+
+    return rng_range(o->min_size, o->max_size);
+}
+
+static int draw_port(const struct bench_opts *o, const double *port_cdf)
+{
+    if (rng_unit() < o->well_known)
+        return zipf_draw(port_cdf, 1024);
+
+    return rng_range(1024, 65535);
+}
+
+// build one frame, returns the wire length
+static int gen_packet(u_char *buf, const struct bench_opts *o,
+                      const double *addr_cdf, const double *port_cdf)
+{
+    int len = draw_size(o);
+    int off = 0;
+    int proto, r, ip_hl = 5, th_off = 5;
+    int l4_len;
+
+    memset(buf, 0, BENCH_SNAP);
+
+    // ethernet, optionally with an 802.1Q tag
+    buf[5] = 0x01;
+    buf[11] = 0x02;
+    off = 12;
+    if (rng_unit() < o->vlan)
+    {
+        put16(buf + off, 0x8100);
+        put16(buf + off + 2, rng_range(1, 4094));
+        off += 4;
+    }
+    put16(buf + off, 0x0800);
+    off += 2;
+
+    if (len < off + 20 + 20)
+        len = off + 20 + 20;
+
+    r = rng_range(0, 99);
+    if (r < o->pct_tcp)
+        proto = IPPROTO_TCP;
+    else if (r < o->pct_tcp + o->pct_udp)
+        proto = IPPROTO_UDP;
+    else if (r < o->pct_tcp + o->pct_udp + o->pct_icmp)
+        proto = IPPROTO_ICMP;
+    else
+        proto = IPPROTO_GRE;
+
+    if (rng_unit() < o->malformed)
+    {
+        if (proto == IPPROTO_TCP && rng_range(0, 1))
+            th_off = rng_range(0, 4);
+        else
+            ip_hl = rng_range(0, 4);
+    }
+
+    // ipv4
+    buf[off] = 0x40 | ip_hl;
+    put16(buf + off + 2, len - off);
+    put16(buf + off + 4, (int)(rng_next() & 0xffff));
+    buf[off + 8] = 64;
+    buf[off + 9] = proto;
+    buf[off + 12] = zipf_draw(addr_cdf, 256);
+    buf[off + 13] = rng_range(0, 255);
+    buf[off + 14] = rng_range(0, 255);
+    buf[off + 15] = rng_range(1, 254);
+    buf[off + 16] = zipf_draw(addr_cdf, 256);
+    buf[off + 17] = rng_range(0, 255);
+    buf[off + 18] = rng_range(0, 255);
+    buf[off + 19] = rng_range(1, 254);
+    off += 20;
+
+    l4_len = len - off;
+    switch (proto)
+    {
+        case IPPROTO_TCP:
+            put16(buf + off, draw_port(o, port_cdf));
+            put16(buf + off + 2, draw_port(o, port_cdf));
+            buf[off + 12] = th_off << 4;
+            buf[off + 13] = (u_char)rng_range(0, 255) & 0x3f;
+            put16(buf + off + 14, 65535);
+            break;
+        case IPPROTO_UDP:
+            put16(buf + off, draw_port(o, port_cdf));
+            put16(buf + off + 2, draw_port(o, port_cdf));
+            put16(buf + off + 4, l4_len);
+            break;
+        case IPPROTO_ICMP:
+            buf[off] = 8;
+            break;
+    }
+
+    return len;
+}
+
+static struct bench_pkt *gen_traffic(const struct bench_opts *o)
+{
+    struct bench_pkt *pkts;
+    u_char *pool;
+    double *addr_cdf, *port_cdf;
+    long i;
+
+    pkts = malloc(o->num_packets*sizeof(*pkts));
+    pool = malloc((size_t)o->num_packets*BENCH_SNAP);
+    if (!pkts || !pool)
+    {
+        fprintf(stderr, "ERROR! bench: out of memory for %ld packets\n", o->num_packets);
+        exit(EXIT_FAILURE);
+    }
+
+    addr_cdf = zipf_cdf(256, o->addr_zipf);
+    port_cdf = zipf_cdf(1024, o->addr_zipf);
+
+    for (i = 0; i < o->num_packets; i++)
+    {
+        pkts[i].data = pool + (size_t)i*BENCH_SNAP;
+        pkts[i].hdr.len = gen_packet(pkts[i].data, o, addr_cdf, port_cdf);
+        pkts[i].hdr.caplen = pkts[i].hdr.len < BENCH_SNAP ? pkts[i].hdr.len : BENCH_SNAP;
+        pkts[i].hdr.ts.tv_sec = 1300000000 + i/o->pps;
+        pkts[i].hdr.ts.tv_usec = (i % o->pps)*1000000/o->pps;
+    }
+
+    free(addr_cdf);
+    free(port_cdf);
+
+    return pkts;
+}
+
+// classic libpcap file, microsecond timestamps, ethernet
+static int write_pcap(const char *path, const struct bench_pkt *pkts, long n)
+{
+    FILE *fp;
+    uint32_t ghdr[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, BENCH_SNAP, DLT_EN10MB };
+    uint32_t rhdr[4];
+    long i;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+    {
+        fprintf(stderr, "ERROR! bench: unable to open %s\n", path);
+        return -1;
+    }
+
+    fwrite(ghdr, sizeof(ghdr), 1, fp);
+
+    for (i = 0; i < n; i++)
+    {
+        rhdr[0] = pkts[i].hdr.ts.tv_sec;
+        rhdr[1] = pkts[i].hdr.ts.tv_usec;
+        rhdr[2] = pkts[i].hdr.caplen;
+        rhdr[3] = pkts[i].hdr.len;
+        fwrite(rhdr, sizeof(rhdr), 1, fp);
+        fwrite(pkts[i].data, 1, pkts[i].hdr.caplen, fp);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *stage, const char *unit, double ops, double ns, uint64_t cyc)
+{
+    printf("%-10s %12.0f %-8s %14.0f %12.2f %12.1f\n", stage, ops, unit,
+           ops/(ns/1e9), ns/ops, cyc/ops);
+}
+
+static void usage(void)
+{
+    printf("Usage: hbtad_bench [options]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("    -n num       Number of synthetic packets (default 200000).\n");
+    printf("    -r passes    Parse passes over the packets (default 5).\n");
+    printf("    -s seed      PRNG seed (default 1).\n");
+    printf("    -p t:u:i     Percent TCP:UDP:ICMP, rest is GRE (default 80:15:4).\n");
+    printf("    -l min:max   Uniform frame sizes, or 'imix' (default 64:1518).\n");
+    printf("    -z s         Zipf exponent for addresses and ports, 0 is uniform (default 1.1).\n");
+    printf("    -P frac      Fraction of well-known ports (default 0.7).\n");
+    printf("    -v frac      Fraction of VLAN tagged frames (default 0).\n");
+    printf("    -m frac      Fraction of malformed IP/TCP headers (default 0.01).\n");
+    printf("    -W num       Number of windows the packets are split into (default 256).\n");
+    printf("    -k num       Number of clusters (default 8).\n");
+    printf("    -b spec      Packet size binning, e.g. log:32 or quantile:16 (default one bin per size).\n");
+    printf("    -B spec      Port binning, e.g. fixed:64 (default one bin per port).\n");
+    printf("    -d spec      Metric space mapping, pca:N, random:N or none (default pca:%d).\n", PROJ_DIMS);
+    printf("    -M metric    Distance, euclid, ned, chi2, hellinger, js or emd (default euclid).\n");
+    printf("    -t pps       Packets per second of capture time (default 100000).\n");
+    printf("    -w file      Also write the traffic to a pcap file.\n");
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_opts o = {
+        200000, 5, 1, 80, 15, 4, 64, 1518, 0, 1.1, 0.7, 0.0, 0.01, 256, 8, 100000, NULL
+    };
+    struct bench_pkt *pkts;
+    struct pkt_features pf;
+    static struct hist win;
+    int **vecs;
+    struct matrix fvecs, centroids;
+    struct arena run = { 0 };
+    struct projection proj;
+    const char *proj_spec = "pca";
+    int *near;
+    FILE *devnull;
+    long i, per_win;
+    int p, w, k, c, len;
+    double t0, t1;
+    uint64_t c0, c1;
+    volatile float sink = 0;
+
+    while ((c = getopt(argc, argv, "n:r:s:p:l:z:P:v:m:W:k:b:B:d:M:t:w:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': o.num_packets = atol(optarg); break;
+            case 'r': o.passes = atoi(optarg); break;
+            case 's': o.seed = strtoul(optarg, NULL, 0); break;
+            case 'p':
+                if (sscanf(optarg, "%d:%d:%d", &o.pct_tcp, &o.pct_udp, &o.pct_icmp) != 3)
+                {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "imix") == 0)
+                    o.imix = 1;
+                else if (sscanf(optarg, "%d:%d", &o.min_size, &o.max_size) != 2
+                         || o.min_size > o.max_size)
+                {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'z': o.addr_zipf = atof(optarg); break;
+            case 'P': o.well_known = atof(optarg); break;
+            case 'v': o.vlan = atof(optarg); break;
+            case 'm': o.malformed = atof(optarg); break;
+            case 'W': o.num_windows = atoi(optarg); break;
+            case 'k': o.num_clusters = atoi(optarg); break;
+            case 'b':
+                if (bins_parse(&size_bins, optarg, 65536, SNAP_LEN) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'B':
+                if (bins_parse(&port_bins, optarg, 1024, 1024) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'd': proj_spec = optarg; break;
+            case 'M':
+                if ((distance_metric = dist_parse(optarg)) < 0)
+                    return EXIT_FAILURE;
+                break;
+            case 't': o.pps = atol(optarg); break;
+            case 'w': o.pcap_out = optarg; break;
+            default:
+                usage();
+                return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (o.num_packets <= 0 || o.passes <= 0 || o.num_windows <= 0
+        || o.num_clusters <= 0 || o.num_clusters > o.num_windows
+        || o.num_packets < o.num_windows)
+    {
+        fprintf(stderr, "ERROR! bench: need packets >= windows >= clusters > 0\n");
+        return EXIT_FAILURE;
+    }
+    if (o.pps <= 0 || o.pps > 1000000)
+    {
+        fprintf(stderr, "ERROR! bench: packets per second must be 1 to 1000000\n");
+        return EXIT_FAILURE;
+    }
+
+    if (proj_parse(&proj, proj_spec) != 0)
+        return EXIT_FAILURE;
+
+    if (dist_needs_counts(distance_metric) && proj.mode != PROJ_NONE)
+    {
+        fprintf(stderr, "ERROR! bench: -M %s needs -d none\n", dist_name(distance_metric));
+        return EXIT_FAILURE;
+    }
+
+    // windows are cut by packet count here, not capture time
+    window_secs = 0;
+
+    // per packet alerts still get formatted and queued, just not shown
+    if ((devnull = fopen("/dev/null", "w")) == NULL || out_start(devnull) != 0)
+        return EXIT_FAILURE;
+
+    rng_state = o.seed ? o.seed : 1;
+    pkts = gen_traffic(&o);
+
+    if (o.pcap_out && write_pcap(o.pcap_out, pkts, o.num_packets) != 0)
+        return EXIT_FAILURE;
+
+    // quantile bins learn from the generated traffic
+    if (bins_need_sample())
+    {
+        for (i = 0; i < o.num_packets; i++)
+        {
+            parse_packet(&pkts[i].hdr, pkts[i].data, &pf);
+            bins_sample(&pf);
+        }
+        bins_learn_sampled();
+    }
+    len = feature_len();
+    emd_nsegs = feature_bounds(emd_bounds, &emd_ordered);
+
+    printf("%ld packets, %d windows, %d clusters, feature length %d, %s distance\n\n",
+           o.num_packets, o.num_windows, o.num_clusters, len, dist_name(distance_metric));
+    printf("%-10s %12s %-8s %14s %12s %12s\n", "stage", "ops", "unit", "ops/sec", "ns/op", "cycles/op");
+
+    // parse + histogram update
+    hist_reset();
+    t0 = now_ns();
+    c0 = cycles();
+    for (p = 0; p < o.passes; p++)
+        for (i = 0; i < o.num_packets; i++)
+            got_packet(NULL, &pkts[i].hdr, pkts[i].data);
+    c1 = cycles();
+    t1 = now_ns();
+    report("parse", "packet", (double)o.num_packets*o.passes, t1 - t0, c1 - c0);
+
+    // one feature vector per window
+    hist_reset();
+    vecs = malloc(o.num_windows*sizeof(int*));
+    per_win = o.num_packets/o.num_windows;
+    for (w = 0; w < o.num_windows; w++)
+    {
+        vecs[w] = malloc(len*sizeof(int));
+        for (i = w*per_win; i < (w + 1)*per_win; i++)
+            got_packet(NULL, &pkts[i].hdr, pkts[i].data);
+        window_close(&win);
+        feature_vec(vecs[w], &win);
+    }
+
+    // metric space mapping
+    t0 = now_ns();
+    c0 = cycles();
+    if (proj.mode == PROJ_PCA)
+        proj_pca(&proj, vecs, o.num_windows, len, proj.out_len, o.seed);
+    else if (proj.mode == PROJ_RANDOM)
+        proj_random(&proj, len, proj.out_len, o.seed);
+    else
+        proj_none(&proj, len);
+    c1 = cycles();
+    t1 = now_ns();
+    report("fit", "run", 1, t1 - t0, c1 - c0);
+
+    matrix_alloc(&fvecs, o.num_windows, proj.out_len);
+
+    t0 = now_ns();
+    c0 = cycles();
+    for (w = 0; w < o.num_windows; w++)
+        proj_apply(&proj, vecs[w], matrix_row(&fvecs, w));
+    c1 = cycles();
+    t1 = now_ns();
+    report("project", "window", o.num_windows, t1 - t0, c1 - c0);
+
+    len = proj.out_len;
+    matrix_alloc(&centroids, o.num_clusters, len);
+    for (k = 0; k < o.num_clusters; k++)
+        memcpy(matrix_row(&centroids, k), matrix_row(&fvecs, k), len*sizeof(float));
+
+    // distance
+    t0 = now_ns();
+    c0 = cycles();
+    for (w = 0; w < o.num_windows; w++)
+        for (k = 0; k < o.num_clusters; k++)
+            sink += distance(matrix_row(&fvecs, w), matrix_row(&centroids, k), len);
+    c1 = cycles();
+    t1 = now_ns();
+    report("distance", "pair", (double)o.num_windows*o.num_clusters, t1 - t0, c1 - c0);
+
+    // batched assignment, the same pairs
+    near = malloc(o.num_windows*sizeof(int));
+    t0 = now_ns();
+    c0 = cycles();
+    kmeans_assign(&fvecs, &centroids, near, NULL);
+    c1 = cycles();
+    t1 = now_ns();
+    report("assign", "pair", (double)o.num_windows*o.num_clusters, t1 - t0, c1 - c0);
+    for (w = 0; w < o.num_windows; w++)
+        sink += near[w];
+    free(near);
+
+    // kmeans
+    t0 = now_ns();
+    c0 = cycles();
+    kmeans(&fvecs, o.num_clusters, &centroids, &run);
+    c1 = cycles();
+    t1 = now_ns();
+    report("kmeans", "window", o.num_windows, t1 - t0, c1 - c0);
+
+    // classify
+    t0 = now_ns();
+    c0 = cycles();
+    for (w = 0; w < o.num_windows; w++)
+        sink += classify(matrix_row(&fvecs, w), &centroids, NULL);
+    c1 = cycles();
+    t1 = now_ns();
+    report("classify", "window", o.num_windows, t1 - t0, c1 - c0);
+
+    printf("\n");
+    stats_dump(stdout);
+
+    arena_free(&run);
+    matrix_free(&centroids);
+    matrix_free(&fvecs);
+    for (w = 0; w < o.num_windows; w++)
+        free(vecs[w]);
+    free(vecs);
+    proj_free(&proj);
+    free(pkts[0].data);
+    free(pkts);
+
+    out_stop();
+
+    return 0;
+}
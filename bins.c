@@ -0,0 +1,233 @@
+/*
+ * Histogram binning, see bins.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hbtad.h"
+#include "bins.h"
+
+// default to one bin per value, same as the plain histograms
+struct binning size_bins = { BIN_FIXED, SNAP_LEN, SNAP_LEN, 1, 1ULL << 32, SNAP_LEN - 1, 0, { 0 } };
+struct binning port_bins = { BIN_FIXED, 1024, 1024, 1, 1ULL << 32, 1023, 0, { 0 } };
+
+// reservoir samples for learning, allocated on first use
+static uint32_t *size_sample, *port_sample;
+static long size_seen, port_seen;
+static uint64_t sample_rng = 88172645463325252ULL;
+
+void bins_fixed(struct binning *b, uint32_t range, int nbins)
+{
+    uint32_t width = (range + nbins - 1)/nbins;
+
+    b->mode = BIN_FIXED;
+    b->nbins = nbins;
+    b->range = range;
+    b->width = width;
+    // exact v/width for any v up to top, which is far below 2^32/width
+    b->mul = ((1ULL << 32) + width - 1)/width;
+    b->top = width*(nbins - 1);
+}
+
+// pad out to a power of 2 and work out the search depth
+static void bins_finish_edges(struct binning *b, int nbins)
+{
+    int i;
+
+    b->nbins = nbins;
+    b->steps = 1;
+    while ((1 << b->steps) < nbins)
+        b->steps++;
+
+    for (i = nbins; i < BIN_MAX_EDGES; i++)
+        b->edges[i] = UINT32_MAX;
+}
+
+void bins_log(struct binning *b, uint32_t range, int nbins)
+{
+    uint32_t e;
+    int i, n;
+
+    b->mode = BIN_LOG;
+    b->range = range;
+    b->edges[0] = 0;
+    n = 1;
+
+    // edges at (range)^(i/nbins), drop the duplicates at the low end
+    for (i = 1; i < nbins; i++)
+    {
+        e = (uint32_t)floor(pow((double)range, (double)i/nbins));
+        if (e > b->edges[n - 1])
+            b->edges[n++] = e;
+    }
+
+    bins_finish_edges(b, n);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void bins_learn(struct binning *b, uint32_t range, int nbins, uint32_t *sample, int n)
+{
+    uint32_t e;
+    int i, k;
+
+    // nothing to learn from, fall back to log bins
+    if (n == 0)
+    {
+        bins_log(b, range, nbins);
+        b->mode = BIN_QUANTILE;
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        if (sample[i] >= range)
+            sample[i] = range - 1;
+
+    qsort(sample, n, sizeof(*sample), cmp_u32);
+
+    b->mode = BIN_QUANTILE;
+    b->range = range;
+    b->edges[0] = 0;
+    k = 1;
+
+    for (i = 1; i < nbins; i++)
+    {
+        e = sample[(long)i*n/nbins];
+        if (e > b->edges[k - 1])
+            b->edges[k++] = e;
+    }
+
+    bins_finish_edges(b, k);
+}
+
+int bins_parse(struct binning *b, const char *spec, uint32_t range, int capacity)
+{
+    const char *colon = strchr(spec, ':');
+    int nbins = 0, max = capacity;
+    long r;
+    char *end;
+
+    if (colon)
+    {
+        nbins = (int)strtol(colon + 1, &end, 10);
+        if (*end == ':')
+        {
+            r = strtol(end + 1, &end, 10);
+            if (r < 2 || r > 65536)
+            {
+                fprintf(stderr, "ERROR! bins: bad range in '%s'\n", spec);
+                return -1;
+            }
+            range = r;
+        }
+    }
+
+    if (strncmp(spec, "fixed:", 6) != 0 && max > BIN_MAX_EDGES)
+        max = BIN_MAX_EDGES;
+
+    if (nbins < 1 || nbins > max || (uint32_t)nbins > range)
+    {
+        fprintf(stderr, "ERROR! bins: bad bin count in '%s', 1-%d allowed\n", spec, max);
+        return -1;
+    }
+
+    if (strncmp(spec, "fixed:", 6) == 0)
+        bins_fixed(b, range, nbins);
+    else if (strncmp(spec, "log:", 4) == 0)
+        bins_log(b, range, nbins);
+    else if (strncmp(spec, "quantile:", 9) == 0)
+    {
+        b->mode = BIN_QUANTILE;
+        b->range = range;
+        b->nbins = nbins;
+        b->steps = 0;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR! bins: unknown binning '%s'\n", spec);
+        return -1;
+    }
+
+    return 0;
+}
+
+uint32_t bin_lower(const struct binning *b, int i)
+{
+    if (b->mode == BIN_FIXED)
+        return (uint32_t)i*b->width;
+
+    return b->edges[i];
+}
+
+int bins_need_sample(void)
+{
+    return bins_unlearned(&size_bins) || bins_unlearned(&port_bins);
+}
+
+static void reservoir_add(uint32_t **sample, long *seen, uint32_t v)
+{
+    uint64_t j;
+
+    if (!*sample && (*sample = malloc(BIN_SAMPLE_MAX*sizeof(uint32_t))) == NULL)
+        return;
+
+    if (*seen < BIN_SAMPLE_MAX)
+    {
+        (*sample)[(*seen)++] = v;
+        return;
+    }
+
+    // xorshift64
+    sample_rng ^= sample_rng << 13;
+    sample_rng ^= sample_rng >> 7;
+    sample_rng ^= sample_rng << 17;
+
+    j = sample_rng % (uint64_t)++(*seen);
+    if (j < BIN_SAMPLE_MAX)
+        (*sample)[j] = v;
+}
+
+void bins_sample(const struct pkt_features *pf)
+{
+    if (bins_unlearned(&size_bins) && pf->size >= 0)
+        reservoir_add(&size_sample, &size_seen, pf->size);
+
+    if (bins_unlearned(&port_bins))
+    {
+        if (pf->src_port >= 0)
+            reservoir_add(&port_sample, &port_seen, pf->src_port);
+        if (pf->dst_port >= 0)
+            reservoir_add(&port_sample, &port_seen, pf->dst_port);
+    }
+}
+
+static void learn_one(struct binning *b, const char *name, uint32_t **sample, long *seen)
+{
+    int n = *seen < BIN_SAMPLE_MAX ? (int)*seen : BIN_SAMPLE_MAX;
+
+    if (!bins_unlearned(b))
+        return;
+
+    if (n == 0)
+        fprintf(stderr, "WARNING! bins: no %s samples, using log bins\n", name);
+
+    bins_learn(b, b->range, b->nbins, *sample, n);
+
+    free(*sample);
+    *sample = NULL;
+    *seen = 0;
+}
+
+void bins_learn_sampled(void)
+{
+    learn_one(&size_bins, "packet size", &size_sample, &size_seen);
+    learn_one(&port_bins, "port", &port_sample, &port_seen);
+}
@@ -0,0 +1,95 @@
+#ifndef BINS_H
+#define BINS_H
+
+/*
+ * Histogram binning for the wide features (packet sizes and ports).
+ *
+ * A binning maps a raw value to one of nbins bins, everything past the
+ * range lands in the top bin.  Bins are either fixed width, found with a
+ * multiply and a clamp, or given by their lower edges (log scale or
+ * learned quantiles), found with a fixed-step binary search.  Neither
+ * lookup branches on the value.
+ */
+
+#include <stdint.h>
+
+enum bin_mode {
+    BIN_FIXED,
+    BIN_LOG,
+    BIN_QUANTILE
+};
+
+// most bins an edge based binning can have, a power of 2
+#define BIN_MAX_EDGES 256
+
+// values kept for learning quantile edges
+#define BIN_SAMPLE_MAX 65536
+
+struct binning {
+    int mode;
+    int nbins;
+    uint32_t range;     // raw values are 0 .. range-1
+    uint32_t width;     // fixed: bin width
+    uint64_t mul;       // fixed: 2^32/width, rounded up
+    uint32_t top;       // fixed: lower edge of the top bin
+    int steps;          // edges: log2 of the padded edge count
+    uint32_t edges[BIN_MAX_EDGES];  // lower edge of each bin, padded with UINT32_MAX
+};
+
+extern struct binning size_bins;
+extern struct binning port_bins;
+
+static inline int bin_lookup(const struct binning *b, uint32_t v)
+{
+    int base, half;
+
+    if (b->mode == BIN_FIXED)
+    {
+        v = v < b->top ? v : b->top;
+        return (int)((v*b->mul) >> 32);
+    }
+
+    v = v < b->range - 1 ? v : b->range - 1;
+    base = 0;
+    for (half = 1 << (b->steps - 1); half > 0; half >>= 1)
+        base += (b->edges[base + half] <= v) ? half : 0;
+
+    return base;
+}
+
+// nbins equal width bins over 0 .. range-1
+void bins_fixed(struct binning *b, uint32_t range, int nbins);
+
+// nbins geometrically growing bins over 0 .. range-1
+void bins_log(struct binning *b, uint32_t range, int nbins);
+
+// nbins bins holding roughly equal shares of the sampled values
+void bins_learn(struct binning *b, uint32_t range, int nbins, uint32_t *sample, int n);
+
+// parse "fixed:N", "log:N" or "quantile:N", optionally followed by ":max"
+// to cover only 0 .. max-1 instead of range.  quantile only records the
+// layout, bins_learn() has to be called before use.  capacity is the most
+// bins the histograms have room for
+int bins_parse(struct binning *b, const char *spec, uint32_t range, int capacity);
+
+// quantile bins still waiting for bins_learn()
+static inline int bins_unlearned(const struct binning *b)
+{
+    return b->mode == BIN_QUANTILE && b->steps == 0;
+}
+
+struct pkt_features;
+
+// true if some binning still needs a sampling pass
+int bins_need_sample(void);
+
+// keep the raw values of a parsed packet for learning quantile edges
+void bins_sample(const struct pkt_features *pf);
+
+// learn every quantile binning from what bins_sample() kept
+void bins_learn_sampled(void);
+
+// lower edge of bin i
+uint32_t bin_lower(const struct binning *b, int i);
+
+#endif
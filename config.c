@@ -0,0 +1,363 @@
+/*
+ * Capture settings, see config.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "hbtad.h"
+#include "hist.h"
+#include "config.h"
+#include "pipeline.h"
+
+struct capture_cfg capture = {
+    .snaplen = SNAP_LEN,
+    .timeout_ms = 1000,
+    .readers = 64,
+    .threads = 1,
+    .parsers = 2,
+    .queue_len = 4096,
+    .cpu_capture = -1,
+    .cpu_parse = -1,
+    .cpu_aggregate = -1,
+    .cpu_vectorize = -1,
+    .cpu_workers = -1,
+    .window = WINDOW_SECS,
+    .clusters = NUM_CLUSTERS,
+};
+
+// every setting, for their HBTAD_<KEY> environment variables
+static const char *config_keys[] = {
+    "interface", "filter", "snaplen", "buffer", "immediate", "timeout", "count",
+    "readers", "threads", "speed", "pipeline", "parsers", "queue", "overflow",
+    "cpu_capture", "cpu_parse", "cpu_aggregate", "cpu_vectorize", "cpu_workers",
+    "hugepages", "deterministic",
+    "window", "clusters", "size_bins", "port_bins", "project", "metric", "store",
+    "train", "model", "retrain", "tenants", "addr_prefixes", "xdp", "xdp_obj",
+    "xdp_mode", "stats_interval", "stats_sock",
+};
+
+static char *config_strdup(const char *s)
+{
+    char *d = strdup(s);
+
+    if (!d)
+    {
+        fprintf(stderr, "ERROR! config: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+// a string kept as it is, checked where it is used
+static int config_string(const char *val, char **out)
+{
+    free(*out);
+    *out = config_strdup(val);
+    return 0;
+}
+
+// a whole number in lo .. hi, 0 on success
+static int config_int(const char *key, const char *val, int lo, int hi, int *out)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(val, &end, 0);
+    if (errno || end == val || *end != '\0' || n < lo || n > hi)
+    {
+        fprintf(stderr, "ERROR! config: %s must be a number from %d to %d, not '%s'\n",
+                key, lo, hi, val);
+        return -1;
+    }
+
+    *out = n;
+    return 0;
+}
+
+// a number from lo up, 0 on success
+static int config_double(const char *key, const char *val, double lo, double *out)
+{
+    char *end;
+    double d;
+
+    errno = 0;
+    d = strtod(val, &end);
+    if (errno || end == val || *end != '\0' || !(d >= lo))
+    {
+        fprintf(stderr, "ERROR! config: %s must be a number of at least %g, not '%s'\n",
+                key, lo, val);
+        return -1;
+    }
+
+    *out = d;
+    return 0;
+}
+
+// set one setting by name, 0 on success
+static int config_set(struct capture_cfg *c, const char *key, const char *val)
+{
+    if (strcmp(key, "interface") == 0)
+        return config_string(val, &c->dev);
+    if (strcmp(key, "filter") == 0)
+        return config_string(val, &c->filter);
+    if (strcmp(key, "snaplen") == 0)
+        return config_int(key, val, 1, 262144, &c->snaplen);
+    if (strcmp(key, "buffer") == 0)
+        return config_int(key, val, 0, INT_MAX/1024, &c->buffer_kib);
+    if (strcmp(key, "immediate") == 0)
+        return config_int(key, val, 0, 1, &c->immediate);
+    if (strcmp(key, "timeout") == 0)
+        return config_int(key, val, 0, INT_MAX, &c->timeout_ms);
+    if (strcmp(key, "count") == 0)
+        return config_int(key, val, 0, INT_MAX, &c->count);
+    if (strcmp(key, "readers") == 0)
+        return config_int(key, val, 1, 65536, &c->readers);
+    if (strcmp(key, "pipeline") == 0)
+        return config_int(key, val, 0, 1, &c->pipeline);
+    if (strcmp(key, "parsers") == 0)
+        return config_int(key, val, 1, PIPE_MAX_PARSERS, &c->parsers);
+    if (strcmp(key, "queue") == 0)
+        return config_int(key, val, 2, 1 << 24, &c->queue_len);
+    if (strcmp(key, "overflow") == 0)
+    {
+        if (strcmp(val, "drop") != 0 && strcmp(val, "block") != 0)
+        {
+            fprintf(stderr, "ERROR! config: overflow must be drop or block, not '%s'\n", val);
+            return -1;
+        }
+        c->drop = strcmp(val, "drop") == 0;
+        return 0;
+    }
+    if (strcmp(key, "cpu_capture") == 0)
+        return config_int(key, val, -1, INT_MAX, &c->cpu_capture);
+    if (strcmp(key, "cpu_parse") == 0)
+        return config_int(key, val, -1, INT_MAX, &c->cpu_parse);
+    if (strcmp(key, "cpu_aggregate") == 0)
+        return config_int(key, val, -1, INT_MAX, &c->cpu_aggregate);
+    if (strcmp(key, "cpu_vectorize") == 0)
+        return config_int(key, val, -1, INT_MAX, &c->cpu_vectorize);
+    if (strcmp(key, "cpu_workers") == 0)
+        return config_int(key, val, -1, INT_MAX, &c->cpu_workers);
+    if (strcmp(key, "hugepages") == 0)
+        return config_int(key, val, 0, 1, &c->hugepages);
+    if (strcmp(key, "deterministic") == 0)
+        return config_int(key, val, 0, 1, &c->deterministic);
+    if (strcmp(key, "speed") == 0)
+        return config_double(key, val, 0, &c->speed);
+    // leaving a histogram shard for the main thread
+    if (strcmp(key, "threads") == 0)
+        return config_int(key, val, 1, HIST_MAX_SHARDS - 1, &c->threads);
+
+    if (strcmp(key, "window") == 0)
+        return config_int(key, val, 0, INT_MAX, &c->window);
+    if (strcmp(key, "clusters") == 0)
+        return config_int(key, val, 1, 65536, &c->clusters);
+    if (strcmp(key, "size_bins") == 0)
+        return config_string(val, &c->size_bins);
+    if (strcmp(key, "port_bins") == 0)
+        return config_string(val, &c->port_bins);
+    if (strcmp(key, "project") == 0)
+        return config_string(val, &c->project);
+    if (strcmp(key, "metric") == 0)
+        return config_string(val, &c->metric);
+    if (strcmp(key, "store") == 0)
+        return config_string(val, &c->store);
+    if (strcmp(key, "train") == 0)
+        return config_int(key, val, 0, INT_MAX, &c->train);
+    if (strcmp(key, "model") == 0)
+        return config_string(val, &c->model);
+    if (strcmp(key, "retrain") == 0)
+        return config_int(key, val, 0, 1, &c->retrain);
+    if (strcmp(key, "tenants") == 0)
+        return config_string(val, &c->tenants);
+    if (strcmp(key, "addr_prefixes") == 0)
+        return config_string(val, &c->addr_prefixes);
+    if (strcmp(key, "xdp") == 0)
+        return config_string(val, &c->xdp);
+    if (strcmp(key, "xdp_obj") == 0)
+        return config_string(val, &c->xdp_obj);
+    if (strcmp(key, "xdp_mode") == 0)
+        return config_string(val, &c->xdp_mode);
+    if (strcmp(key, "stats_interval") == 0)
+        return config_int(key, val, 0, INT_MAX, &c->stats_interval);
+    if (strcmp(key, "stats_sock") == 0)
+        return config_string(val, &c->stats_sock);
+
+    fprintf(stderr, "ERROR! config: unknown setting '%s'\n", key);
+    return -1;
+}
+
+static char *trim(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    for (e = s + strlen(s); e > s && isspace((unsigned char)e[-1]); e--)
+        ;
+    *e = '\0';
+
+    return s;
+}
+
+int config_load(struct capture_cfg *c, const char *path)
+{
+    char line[4096], *key, *val, *p;
+    int lineno = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR! config: unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+
+        key = trim(line);
+        if (*key == '\0')
+            continue;
+
+        if ((p = strchr(key, '=')) == NULL)
+        {
+            fprintf(stderr, "ERROR! config: %s:%d: expected key = value\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+        *p = '\0';
+        key = trim(key);
+        val = trim(p + 1);
+
+        if (config_set(c, key, val) != 0)
+        {
+            fprintf(stderr, "ERROR! config: in %s:%d\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+// HBTAD_<KEY> for every setting, empty ones count as not set.  0 on success
+static int config_env(struct capture_cfg *c)
+{
+    char name[64], *val, *p;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(config_keys)/sizeof(config_keys[0]); i++)
+    {
+        snprintf(name, sizeof(name), "HBTAD_%s", config_keys[i]);
+        for (p = name; *p; p++)
+            *p = toupper((unsigned char)*p);
+
+        if ((val = getenv(name)) == NULL || *val == '\0')
+            continue;
+        if (config_set(c, config_keys[i], val) != 0)
+        {
+            fprintf(stderr, "ERROR! config: in %s\n", name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// -o key=value, 0 on success
+static int config_option(struct capture_cfg *c, char *opt)
+{
+    char *val = strchr(opt, '=');
+
+    if (!val)
+    {
+        fprintf(stderr, "ERROR! config: -o %s: expected key=value\n", opt);
+        return -1;
+    }
+    *val = '\0';
+    return config_set(c, trim(opt), trim(val + 1));
+}
+
+int config_args(struct capture_cfg *c, int argc, char **argv)
+{
+    static const char *keys[128] = {
+        ['i'] = "interface", ['f'] = "filter", ['s'] = "snaplen", ['B'] = "buffer",
+        ['t'] = "timeout", ['c'] = "count", ['R'] = "readers", ['T'] = "threads",
+        ['x'] = "speed", ['p'] = "parsers"
+    };
+    static const char *opts = "C:o:i:f:s:B:t:c:R:T:x:p:PDUh";
+    int opt, err = opterr;
+
+    // the file first, so the environment and the other options win over
+    // it.  getopt() finds it in both passes, bundled or not, errors are left
+    // to the second
+    opterr = 0;
+    while ((opt = getopt(argc, argv, opts)) != -1)
+        if (opt == 'C' && config_load(c, optarg) != 0)
+        {
+            opterr = err;
+            return -1;
+        }
+    opterr = err;
+    optind = 1;
+
+    if (config_env(c) != 0)
+        return -1;
+
+    while ((opt = getopt(argc, argv, opts)) != -1)
+    {
+        switch (opt)
+        {
+            case 'C':
+                break;
+            case 'o':
+                if (config_option(c, optarg) != 0)
+                    return -1;
+                break;
+            case 'U':
+                c->immediate = 1;
+                break;
+            case 'P':
+                c->pipeline = 1;
+                break;
+            case 'D':
+                c->deterministic = 1;
+                break;
+            case 'h':
+                print_app_usage();
+                return 1;
+            case '?':
+                print_app_usage();
+                return -1;
+            default:
+                if (config_set(c, keys[opt], optarg) != 0)
+                    return -1;
+                break;
+        }
+    }
+
+    c->files = argv + optind;
+    c->nfiles = argc - optind;
+
+    if (c->deterministic)
+    {
+        if (c->speed > 0)
+            fprintf(stderr, "warning: config: deterministic, replaying unpaced\n");
+        c->threads = 1;
+        c->drop = 0;
+        c->speed = 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * Capture and detection settings, from a config file, the environment and
+ * the command line.
+ *
+ * The config file (-C file) has "key = value" lines, '#' starts a comment:
+ *
+ *     interface = eth1         # live capture, instead of a file
+ *     filter    = ip and not port 22
+ *     snaplen   = 96           # bytes kept per packet, live only
+ *     buffer    = 65536        # kernel buffer in KiB, live only
+ *     immediate = 1            # hand packets over as they arrive
+ *     timeout   = 100          # read timeout in ms, live only
+ *     count     = 0            # stop after this many packets, 0 for never
+ *     readers   = 64           # most files open at once, see replay.h
+ *     threads   = 1            # files read in parallel without windows
+ *     speed     = 1            # replay files in real time, 0 for flat out
+ *     pipeline  = 1            # staged capture, see pipeline.h
+ *     parsers   = 2            # parse stage threads
+ *     queue     = 4096         # packets per parse queue
+ *     overflow  = drop         # or block, when the parse queues are full
+ *     cpu_capture = 0          # pin the stages, -1 for no pinning
+ *     cpu_parse = 1            # and 2 for the second parser
+ *     cpu_aggregate = 3
+ *     cpu_vectorize = 4
+ *     cpu_workers = 5          # first core of the parallel file readers
+ *     hugepages = 1            # 2 MB pages for large tables, see affinity.h
+ *     deterministic = 1        # the same output from the same files, always
+ *
+ *     window    = 10           # seconds of capture time, 0 for one window
+ *     clusters  = 8
+ *     size_bins = log:32       # fixed:N, log:N or quantile:N, see bins.h
+ *     port_bins = fixed:64
+ *     project   = pca:32       # or random:N or none, see proj.h
+ *     metric    = euclid       # see distance.h
+ *     store     = /var/lib/hbtad   # window history, see store.h
+ *     train     = 604800       # train on this many seconds of it
+ *     model     = hbtad.model  # see model.h
+ *     retrain   = 1            # move the model instead of starting over
+ *     tenants   = tenants.txt  # see tenant.h
+ *     addr_prefixes = prefixes.txt # see addr.h
+ *     xdp       = eth1         # count in the kernel instead, see xdp.h
+ *     xdp_obj   = hbtad_xdp.o
+ *     xdp_mode  = skb          # or drv
+ *     stats_interval = 10      # dump the stats every so many seconds
+ *     stats_sock = /tmp/hbtad.sock # and answer queries here, see stats.h
+ *
+ * Each setting can also be given as HBTAD_<KEY> in the environment, e.g.
+ * HBTAD_WINDOW=0, which wins over the file, and as -o key=value on the
+ * command line, which wins over both.  The capture settings have short
+ * options of their own too.
+ *
+ * deterministic = 1 (-D) turns off everything whose outcome depends on
+ * timing or on how hbtad was called: files are merged on one thread
+ * (threads = 1), full queues hold the capture up (overflow = block),
+ * alerts wait for the output ring instead of being dropped, and replays
+ * aren't paced.  Packets at the same time in several files go in path
+ * order, not command line order.  The random
+ * projections and PCA already use fixed seeds.  Two runs over the same
+ * files then print exactly the same, see tests/.
+ */
+
+struct capture_cfg {
+    char **files;           // capture files or directories to read
+    int nfiles;
+    char *dev;              // or the device to capture on
+    char *filter;           // NULL for the link type's default, see pcapng.h
+    int snaplen;
+    int buffer_kib;         // 0 keeps libpcap's default
+    int immediate;
+    int timeout_ms;
+    int count;
+    int readers;            // most files open at once when merging
+    int threads;            // files read side by side when order doesn't matter
+    double speed;           // replay pace, times real time, 0 for no pacing
+    int pipeline;           // run capture in stages, see pipeline.h
+    int parsers;            // parse stage threads
+    int queue_len;          // slots per parse queue
+    int drop;               // drop packets when the parse queues are full
+    int cpu_capture;        // cores to pin the stages to, -1 for none
+    int cpu_parse;          // the first parser, the others on the next ones
+    int cpu_aggregate;
+    int cpu_vectorize;
+    int cpu_workers;        // the first file reader, the others on the next ones
+    int hugepages;          // back large allocations with huge pages
+    int deterministic;      // nothing that depends on timing, see above
+
+    // what to do with the windows, see main.c.  NULL strings for defaults
+    int window;             // seconds, 0 for one window over everything
+    int clusters;
+    char *size_bins;
+    char *port_bins;
+    char *project;          // NULL picks by the metric
+    char *metric;
+    char *store;
+    int train;              // seconds of stored history, 0 for this capture
+    char *model;
+    int retrain;
+    char *tenants;
+    char *addr_prefixes;
+    char *xdp;
+    char *xdp_obj;
+    char *xdp_mode;
+    int stats_interval;     // 0 for no periodic dump
+    char *stats_sock;
+};
+
+extern struct capture_cfg capture;
+
+// read a config file into c, 0 on success
+int config_load(struct capture_cfg *c, const char *path);
+
+// parse the command line, options and then the files to read, into c,
+// after the -C file and the environment.  0 to go on, 1 if only help was
+// asked for, -1 on errors
+int config_args(struct capture_cfg *c, int argc, char **argv);
+
+#endif
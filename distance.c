@@ -0,0 +1,39 @@
+/*
+ * Distance metric selection, the kernels are in distance.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "distance.h"
+
+#ifdef HBTAD_METRIC
+int distance_metric = HBTAD_METRIC;
+#else
+int distance_metric = DIST_EUCLID;
+#endif
+
+int emd_bounds[EMD_MAX_SEGS + 1];
+int emd_nsegs;
+unsigned int emd_ordered;
+
+static const char *metric_names[NUM_METRICS] = {
+    "euclid", "ned", "chi2", "hellinger", "js", "emd"
+};
+
+int dist_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_METRICS; i++)
+        if (strcmp(name, metric_names[i]) == 0)
+            return i;
+
+    fprintf(stderr, "ERROR! distance: unknown metric '%s'\n", name);
+    return -1;
+}
+
+const char *dist_name(int metric)
+{
+    return metric >= 0 && metric < NUM_METRICS ? metric_names[metric] : "?";
+}
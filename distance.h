@@ -0,0 +1,284 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+/*
+ * Distance kernels.
+ *
+ * All kernels are static inline so the clustering loops get them inlined,
+ * there is no call per component and no function pointer per pair.  They
+ * are written once against the vector layer in simd.h.
+ *
+ *   DIST_EUCLID     euclidean, the right one in a pca/random mapped space
+ *   DIST_NED        the original n_e_d(), 2 for every component that differs
+ *   DIST_CHI2       chi-squared, sum (a-b)^2/(a+b)
+ *   DIST_HELLINGER  hellinger, sqrt(sum (sqrt a - sqrt b)^2 / 2)
+ *   DIST_JS         jensen-shannon divergence, natural log
+ *   DIST_EMD        earth mover's over ordered bins, per feature segment,
+ *                   L1 over the segments whose bins have no order
+ *
+ * The histogram metrics only make sense on raw, non-negative counts
+ * (HBTAD_PROJECT=none).
+ */
+
+#include <math.h>
+#include <float.h>
+
+#include "simd.h"
+
+enum dist_metric {
+    DIST_EUCLID,
+    DIST_NED,
+    DIST_CHI2,
+    DIST_HELLINGER,
+    DIST_JS,
+    DIST_EMD,
+    NUM_METRICS
+};
+
+// most feature segments DIST_EMD resets its running sum at
+#define EMD_MAX_SEGS 16
+
+// segment boundaries for DIST_EMD, emd_bounds[0] = 0 .. emd_bounds[n] = len,
+// with emd_nsegs = 0 the whole vector is one ordered segment.  Bit i of
+// emd_ordered is set when segment i's bins are in an order mass can move
+// along (sizes, ports); the others (addresses, protocols, flags) have no
+// ground distance between their bins and are compared bin by bin
+extern int emd_bounds[EMD_MAX_SEGS + 1];
+extern int emd_nsegs;
+extern unsigned int emd_ordered;
+
+// metric used by kmeans() and classify() unless HBTAD_METRIC fixes it
+extern int distance_metric;
+
+// parse "euclid", "ned", "chi2", "hellinger", "js" or "emd", -1 if unknown
+int dist_parse(const char *name);
+const char *dist_name(int metric);
+
+// true for the metrics that need non-negative histogram counts
+static inline int dist_needs_counts(int metric)
+{
+    return metric == DIST_CHI2 || metric == DIST_HELLINGER
+        || metric == DIST_JS || metric == DIST_EMD;
+}
+
+/*
+ * kernels, each does the vector body and then the scalar tail
+ */
+
+static inline float dist_euclid(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), d;
+    float s, x;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+    {
+        d = vf_sub(vf_load(a + i), vf_load(b + i));
+        acc = vf_add(acc, vf_mul(d, d));
+    }
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+    {
+        x = a[i] - b[i];
+        s += x*x;
+    }
+
+    return sqrtf(s);
+}
+
+// squared length, for the ||x||^2 + ||c||^2 - 2 x.c form of euclidean
+static inline float dist_sqnorm(const float *a, int len)
+{
+    vf acc = vf_zero(), x;
+    float s;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+    {
+        x = vf_load(a + i);
+        acc = vf_fma(x, x, acc);
+    }
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+        s += a[i]*a[i];
+
+    return s;
+}
+
+static inline float dist_ned(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), two = vf_set1(2.0f);
+    float s;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+        acc = vf_add(acc, vf_and(vf_neq(vf_load(a + i), vf_load(b + i)), two));
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+        s += a[i] != b[i] ? 2.0f : 0.0f;
+
+    return s;
+}
+
+static inline float dist_chi2(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), x, y, d, n, tiny = vf_set1(FLT_MIN);
+    float s, sum;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+    {
+        x = vf_load(a + i);
+        y = vf_load(b + i);
+        d = vf_sub(x, y);
+        n = vf_add(x, y);
+        // 0/0 for two empty bins, the numerator is 0 so any divisor does
+        acc = vf_add(acc, vf_div(vf_mul(d, d), vf_max(n, tiny)));
+    }
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+    {
+        sum = a[i] + b[i];
+        if (sum > 0)
+            s += (a[i] - b[i])*(a[i] - b[i])/sum;
+    }
+
+    return s;
+}
+
+static inline float dist_hellinger(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), d, zero = vf_zero();
+    float s, x;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+    {
+        d = vf_sub(vf_sqrt(vf_max(vf_load(a + i), zero)), vf_sqrt(vf_max(vf_load(b + i), zero)));
+        acc = vf_add(acc, vf_mul(d, d));
+    }
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+    {
+        x = sqrtf(fmaxf(a[i], 0)) - sqrtf(fmaxf(b[i], 0));
+        s += x*x;
+    }
+
+    return sqrtf(s*0.5f);
+}
+
+static inline float dist_js(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), x, y, m, tiny = vf_set1(FLT_MIN), half = vf_set1(0.5f);
+    float s, p, q, r;
+    int i;
+
+    // x log x + y log y - (x+y) log((x+y)/2), 0 log 0 taken as 0
+    for (i = 0; i + VF_W <= len; i += VF_W)
+    {
+        x = vf_max(vf_load(a + i), vf_zero());
+        y = vf_max(vf_load(b + i), vf_zero());
+        m = vf_add(x, y);
+        acc = vf_add(acc, vf_mul(x, vf_log(vf_max(x, tiny))));
+        acc = vf_add(acc, vf_mul(y, vf_log(vf_max(y, tiny))));
+        acc = vf_sub(acc, vf_mul(m, vf_log(vf_max(vf_mul(m, half), tiny))));
+    }
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+    {
+        p = fmaxf(a[i], 0);
+        q = fmaxf(b[i], 0);
+        r = p + q;
+        if (p > 0)
+            s += p*logf(p);
+        if (q > 0)
+            s += q*logf(q);
+        if (r > 0)
+            s -= r*logf(r*0.5f);
+    }
+
+    return s > 0 ? s*0.5f : 0.0f;
+}
+
+// sum |prefix(a - b)| over one ordered segment
+static inline float emd_segment(const float *a, const float *b, int len)
+{
+    float s = 0, run = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps(), carry = _mm_setzero_ps(), x;
+    __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    // 4 lane inclusive scan in registers, carry the last lane along
+    for (; i + 4 <= len; i += 4)
+    {
+        x = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+        x = _mm_add_ps(x, carry);
+        carry = _mm_shuffle_ps(x, x, 0xff);
+        acc = _mm_add_ps(acc, _mm_and_ps(x, absmask));
+    }
+
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    s = _mm_cvtss_f32(acc);
+    run = _mm_cvtss_f32(carry);
+#endif
+
+    for (; i < len; i++)
+    {
+        run += a[i] - b[i];
+        s += fabsf(run);
+    }
+
+    return s;
+}
+
+// sum |a - b| over a segment without an order
+static inline float l1_segment(const float *a, const float *b, int len)
+{
+    vf acc = vf_zero(), sign = vf_set1(-0.0f);
+    float s;
+    int i;
+
+    for (i = 0; i + VF_W <= len; i += VF_W)
+        acc = vf_add(acc, vf_andnot(sign, vf_sub(vf_load(a + i), vf_load(b + i))));
+
+    s = vf_hsum(acc);
+    for (; i < len; i++)
+        s += fabsf(a[i] - b[i]);
+
+    return s;
+}
+
+static inline float dist_emd(const float *a, const float *b, int len)
+{
+    float s = 0;
+    int i, lo, hi;
+
+    if (emd_nsegs == 0)
+        return emd_segment(a, b, len);
+
+    for (i = 0; i < emd_nsegs; i++)
+    {
+        lo = emd_bounds[i];
+        hi = emd_bounds[i + 1] < len ? emd_bounds[i + 1] : len;
+        if (hi <= lo)
+            continue;
+        if (emd_ordered & (1u << i))
+            s += emd_segment(a + lo, b + lo, hi - lo);
+        else
+            s += l1_segment(a + lo, b + lo, hi - lo);
+    }
+
+    return s;
+}
+
+#endif
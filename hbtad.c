@@ -124,16 +124,33 @@
 #include <limits.h>
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-/* default snap length (maximum bytes per packet to capture) */
-#define SNAP_LEN 1518
-
-/* ethernet headers are always exactly 14 bytes [1] */
-#define SIZE_ETHERNET 14
+#include "hbtad.h"
+#include "output.h"
+#include "stats.h"
+#include "hist.h"
+#include "bins.h"
+#include "addr.h"
+#include "distance.h"
+#include "matrix.h"
+#include "tenant.h"
+#include "xdp.h"
+#include "config.h"
+#include "replay.h"
+#include "pipeline.h"
+#include "affinity.h"
+#include "pcapng.h"
+
+_Static_assert(sizeof(struct xdp_hist) == sizeof(struct hist),
+               "struct xdp_hist must match struct hist");
+_Static_assert(XDP_SNAP_LEN == SNAP_LEN, "XDP_SNAP_LEN must match SNAP_LEN");
 
 /* Ethernet addresses are 6 bytes */
 #define ETHER_ADDR_LEN  6
@@ -145,8 +162,14 @@ struct sniff_ethernet {
         u_short ether_type;                     /* IP? ARP? RARP? etc */
 };
 
-/* IP header */
-struct sniff_ip {
+/*
+ * IP header
+ *
+ * The IP and TCP headers are packed: they start wherever the link header
+ * leaves them, 14 bytes into an ethernet frame, so they can't be assumed
+ * aligned.  The layout is the same either way.
+ */
+struct __attribute__((packed)) sniff_ip {
         u_char  ip_vhl;                 /* version << 4 | header length >> 2 */
         u_char  ip_tos;                 /* type of service */
         u_short ip_len;                 /* total length */
@@ -167,7 +190,7 @@ struct sniff_ip {
 /* TCP header */
 typedef u_int tcp_seq;
 
-struct sniff_tcp {
+struct __attribute__((packed)) sniff_tcp {
         u_short th_sport;               /* source port */
         u_short th_dport;               /* destination port */
         tcp_seq th_seq;                 /* sequence number */
@@ -189,86 +212,14 @@ struct sniff_tcp {
         u_short th_urp;                 /* urgent pointer */
 };
 
-// only care about most sig 8 bits
-int src_ip_addrs[256];
-int dst_ip_addrs[256];
-
-// only care about ports 0-1023
-int src_ports[1024];
-int dst_ports[1024];
-
-// tcp, udp, icmp, or ip
-int protocols[4];
-
-// defined above
-int packet_sizes[SNAP_LEN];
-
-// flags 8 flags, 256 combinations
-int flags[256];
-
-
-void
-got_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet);
-
-void
-print_payload(const u_char *payload, int len);
-
-void
-print_hex_ascii_line(const u_char *payload, int len, int offset);
-
-void
-print_app_banner(void);
-
-void
-print_app_usage(void);
-
-float std_dev_mult(int **vectors, int num_vecs, int vec_len);
-float std_dev(float *vals, int n);
-void mean_vec(int *m_vec, int **vecs, int num_vecs, int vec_len);
-
-int main(int argc, char *argv[])
-{
-  int i;
-  printf("Loading data..\n");
-  load(argc, argv);
-  //printf("Extracting features..\n");
-  for (i = 0; i < 256; i++)
-  {
-    printf("saddr: %d\t count: %d\n", i, src_ip_addrs[i]);
-  }
-
-  for (i = 0; i < 256; i++)
-  {
-    printf("daddr: %d\t count: %d\n", i, dst_ip_addrs[i]);
-  }
-
-  for (i = 0; i < 1024; i++)
-  {
-    printf("sport: %d\t count: %d\n", i, src_ports[i]);
-  }
-
-  for (i = 0; i < 1024; i++)
-  {
-    printf("dport: %d\t count: %d\n", i, dst_ports[i]);
-  }
-
-  for (i = 0; i < 4; i++)
-  {
-    printf("protocol: %d\t count: %d\n", i, protocols[i]);
-  }
-
-  for (i = 0; i < SNAP_LEN; i++)
-  {
-    printf("packet size: %d\t count: %d\n", i, packet_sizes[i]);
-  }
+// window length in seconds of capture time, 0 makes it one big window
+int window_secs = WINDOW_SECS;
 
-  printf("Mapping to metric space..\n");
-  printf("Clustering..\n");
-  printf("Classifying..\n");
-  printf("Finished.\n");
+// all closed windows summed up, the windows themselves are per tenant
+struct hist hist_total;
 
-  return 0;
-}
+// capture time the current window started at, -1 before the first packet
+static long win_start = -1;
 
 /*
  * app name/banner
@@ -277,10 +228,10 @@ void
 print_app_banner(void)
 {
 
-        printf("%s - %s\n", APP_NAME, APP_DESC);
-        printf("%s\n", APP_COPYRIGHT);
-        printf("%s\n", APP_DISCLAIMER);
-        printf("\n");
+        out_printf("%s - %s\n", APP_NAME, APP_DESC);
+        out_printf("%s\n", APP_COPYRIGHT);
+        out_printf("%s\n", APP_DISCLAIMER);
+        out_printf("\n");
 
 return;
 }
@@ -292,11 +243,26 @@ void
 print_app_usage(void)
 {
 
-        printf("Usage: %s [file]\n", APP_NAME);
-        printf("\n");
-        printf("Options:\n");
-        printf("    file    Process file that contains pcap dump.\n");
-        printf("\n");
+        out_printf("Usage: %s [options] [file...]\n", APP_NAME);
+        out_printf("\n");
+        out_printf("Options:\n");
+        out_printf("    file        Process files with pcap dumps, or directories of them.\n");
+        out_printf("    -i dev      Capture live on dev instead.\n");
+        out_printf("    -f expr     Filter expression (default \"ip\", \"ip or (vlan and ip)\" on ethernet).\n");
+        out_printf("    -s len      Snapshot length in bytes (default %d).\n", SNAP_LEN);
+        out_printf("    -B kib      Capture buffer size in KiB (default libpcap's).\n");
+        out_printf("    -U          Immediate mode, no buffering in the kernel.\n");
+        out_printf("    -t ms       Read timeout (default 1000).\n");
+        out_printf("    -c num      Stop after num packets (default 0, no limit).\n");
+        out_printf("    -R num      Most files open at once when merging (default 64).\n");
+        out_printf("    -T num      Files read in parallel, with HBTAD_WINDOW=0 (default 1).\n");
+        out_printf("    -x speed    Replay files paced at speed times real time (default 0, flat out).\n");
+        out_printf("    -P          Run capture as a staged pipeline.\n");
+        out_printf("    -p num      Parse threads in the pipeline (default 2).\n");
+        out_printf("    -D          Deterministic, the same output for the same files.\n");
+        out_printf("    -C file     Read settings from a config file.\n");
+        out_printf("    -o key=val  Any config file setting, e.g. -o window=60.\n");
+        out_printf("\n");
 
 return;
 }
@@ -400,315 +366,690 @@ return;
 }
 
 /*
- * dissect/print packet
+ * dissect an ethernet frame, fill in what it contributes to the histograms
+ *
+ * No side effects, returns PARSE_OK or what was wrong with the packet.
  */
-void
-got_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet)
+int
+parse_packet(const struct pcap_pkthdr *header, const u_char *packet, struct pkt_features *pf)
 {
+        int off = ether_l3_off(packet, (int)header->caplen);
 
-        static int count = 1;                   /* packet counter */
+        return parse_ip(packet + off, (int)header->caplen - off, pf);
+}
+
+/*
+ * where the IP header of an ethernet frame starts
+ *
+ * One 802.1Q (or 802.1ad) tag is stepped over, as far as the default
+ * filter lets tagged frames through, see link_filter().  A frame too short
+ * to tell is taken as untagged and left to parse_ip() to call truncated.
+ */
+int
+ether_l3_off(const u_char *frame, int caplen)
+{
+        int type;
+
+        if (caplen < SIZE_ETHERNET)
+                return SIZE_ETHERNET;
+
+        type = frame[12] << 8 | frame[13];
+        if (type == 0x8100 || type == 0x88a8 || type == 0x9100)
+                return SIZE_ETHERNET + SIZE_VLAN;
+
+        return SIZE_ETHERNET;
+}
+
+/*
+ * the same from the IP header on, for any link type
+ *
+ * Sizes still count the ethernet header, so the features don't depend on
+ * the link the packet came from.  Only the first len bytes are looked at,
+ * a packet cut off inside a header is PARSE_TRUNCATED, with whatever came
+ * before the cut still filled in.  Sizes come from the IP total length,
+ * as they always have, not from what was captured.
+ */
+int
+parse_ip(const u_char *l3, int len, struct pkt_features *pf)
+{
 
         /* declare pointers to packet headers */
-        const struct sniff_ethernet *ethernet;  /* The ethernet header [1] */
         const struct sniff_ip *ip;              /* The IP header */
         const struct sniff_tcp *tcp;            /* The TCP header */
-        const char *payload;                    /* Packet payload */
 
         int size_ip;
         int size_tcp;
         int size_payload;
 
-        //printf("\rPacket number %d:", count);
-        printf("\nPacket number %d:\n", count);
-        count++;
-
-        /* define ethernet header */
-        ethernet = (struct sniff_ethernet*)(packet);
+        pf->src_ip = -1;
+        pf->dst_ip = -1;
+        pf->protocol = -1;
+        pf->src_port = -1;
+        pf->dst_port = -1;
+        pf->flags = -1;
+        pf->size = -1;
+        pf->bad_len = 0;
+        pf->saddr = 0;
+        pf->daddr = 0;
+        pf->tenant = 0;
+
+        /* the fixed part of the IP header at least */
+        if (len < 20) {
+                pf->bad_len = len > 0 ? len : 0;
+                return PARSE_TRUNCATED;
+        }
 
         /* define/compute ip header offset */
-        ip = (struct sniff_ip*)(packet + SIZE_ETHERNET);
+        ip = (struct sniff_ip*)l3;
         size_ip = IP_HL(ip)*4;
         if (size_ip < 20) {
-                printf("   * Invalid IP header length: %u bytes\n", size_ip);
-                return;
+                pf->bad_len = size_ip;
+                return PARSE_BAD_IP;
         }
 
         /* print source and destination IP addresses */
         //printf("       From: %s\n", inet_ntoa(ip->ip_src));
-        // we only care about lower 8 bits of the address
-        //unsigned long src_ip_addr = ip->ip_src.s_addr;
-        //printf("       From: %lu\n", src_ip_addr);
-        //printf("       From: %d\n", (int)((src_ip_addr >> 24) & 0xFF));
-        src_ip_addrs[(int)((ip->ip_src.s_addr >> 24) & 0xFF)]++;
         //printf("         To: %s\n", inet_ntoa(ip->ip_dst));
-        dst_ip_addrs[(int)((ip->ip_dst.s_addr >> 24) & 0xFF)]++;
+        pf->saddr = ntohl(ip->ip_src.s_addr);
+        pf->daddr = ntohl(ip->ip_dst.s_addr);
+        // the last octet, or the prefix group, see addr.h
+        pf->src_ip = addr_bin(pf->saddr);
+        pf->dst_ip = addr_bin(pf->daddr);
 
         /* determine protocol */
         switch(ip->ip_p) {
                 case IPPROTO_TCP:
-                  //printf("   Protocol: TCP\n");
-                  protocols[0]++;
+                  pf->protocol = 0;
                         break;
                 case IPPROTO_UDP:
-                  //printf("   Protocol: UDP\n");
-                  protocols[1]++;
-                  packet_sizes[SIZE_ETHERNET + size_ip]++;
-                        return;
+                  pf->protocol = 1;
+                  pf->size = SIZE_ETHERNET + size_ip;
+                        return PARSE_OK;
                 case IPPROTO_ICMP:
-                  //printf("   Protocol: ICMP\n");
-                  protocols[2]++;
-                  packet_sizes[SIZE_ETHERNET + size_ip]++;
-                        return;
+                  pf->protocol = 2;
+                  pf->size = SIZE_ETHERNET + size_ip;
+                        return PARSE_OK;
                 case IPPROTO_IP:
-                  //printf("   Protocol: IP\n");
-                  protocols[3]++;
-                  packet_sizes[SIZE_ETHERNET + size_ip]++;
-                        return;
+                  pf->protocol = 3;
+                  pf->size = SIZE_ETHERNET + size_ip;
+                        return PARSE_OK;
                 default:
-                  //printf("   Protocol: unknown\n");
                   // Consider if we want to keep track of these or not
-                  packet_sizes[SIZE_ETHERNET + size_ip]++;
-                        return;
+                  pf->size = SIZE_ETHERNET + size_ip;
+                        return PARSE_OK;
         }
 
         /*
          *  OK, this packet is TCP.
          */
 
+        /* the TCP header past the IP options, options of its own aren't read */
+        if (len < size_ip + 20) {
+                pf->bad_len = len;
+                return PARSE_TRUNCATED;
+        }
+
         /* define/compute tcp header offset */
-        tcp = (struct sniff_tcp*)(packet + SIZE_ETHERNET + size_ip);
+        tcp = (struct sniff_tcp*)(l3 + size_ip);
         size_tcp = TH_OFF(tcp)*4;
         if (size_tcp < 20) {
-                printf("   * Invalid TCP header length: %u bytes\n", size_tcp);
-                return;
+                pf->bad_len = size_tcp;
+                return PARSE_BAD_TCP;
         }
 
-        flags[(int)tcp->th_flags]++;
+        pf->flags = (int)tcp->th_flags;
 
         //printf("   Src port: %d\n", ntohs(tcp->th_sport));
         if (tcp->th_sport < 1024)
-          src_ports[tcp->th_sport]++;
+          pf->src_port = tcp->th_sport;
         //printf("   Dst port: %d\n", ntohs(tcp->th_dport));
         if (tcp->th_dport < 1024)
-          dst_ports[tcp->th_dport]++;
-
-        /* define/compute tcp payload (segment) offset */
-        payload = (u_char *)(packet + SIZE_ETHERNET + size_ip + size_tcp);
+          pf->dst_port = tcp->th_dport;
 
         /* compute tcp payload (segment) size */
         size_payload = ntohs(ip->ip_len) - (size_ip + size_tcp);
         //printf("Payload size: %d\n", size_payload);
 
-        if (size_payload+SIZE_ETHERNET + size_ip < SNAP_LEN)
-          packet_sizes[size_payload]++;
-        else
-          printf("PACKET OVERSIZED: %d bytes\n", size_payload+SIZE_ETHERNET+size_ip);
+        // anything too big for the size bins ends up in the top bin
+        pf->size = size_payload;
+        if (size_payload+SIZE_ETHERNET + size_ip >= SNAP_LEN) {
+          pf->bad_len = size_payload+SIZE_ETHERNET+size_ip;
+          return PARSE_OVERSIZED;
+        }
+
+return PARSE_OK;
+}
 
+/*
+ * pcap callback, parse and count a packet
+ */
+void
+got_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet)
+{
+        int off = ether_l3_off(packet, (int)header->caplen);
 
-        //if (size_payload > max_payload_size)
-        //  max_payload_size = size_payload;
+        got_ip(header, packet + off, (int)header->caplen - off);
+}
 
-        /*
-         * Print payload data; it might be binary, so don't just
-         * treat it as a string.
-         */
-        //if (size_payload > 0) {
-        //        printf("   Payload (%d bytes):\n", size_payload);
-        //        print_payload(payload, size_payload);
-        //}
+/*
+ * parse a packet given from its IP header on and count the outcome, the
+ * part of got_ip() that the pipeline runs in its parse stage
+ */
+int
+parse_count(const u_char *l3, int len, struct pkt_features *pf)
+{
+        int ret;
+        STAT_TIMER(t);
+
+        STAT_START(t);
+        STAT_INC(STAT_PACKETS);
+
+        switch ((ret = parse_ip(l3, len, pf))) {
+                case PARSE_BAD_IP:
+                        STAT_INC(STAT_INVALID_IP);
+                        break;
+                case PARSE_BAD_TCP:
+                        STAT_INC(STAT_INVALID_TCP);
+                        break;
+                case PARSE_OVERSIZED:
+                        STAT_INC(STAT_OVERSIZED);
+                        break;
+                case PARSE_TRUNCATED:
+                        STAT_INC(STAT_TRUNCATED);
+                        break;
+        }
+        pf->tenant = tenant_of(pf);
+        STAT_LAP(t, STAGE_PARSE);
+
+        return ret;
+}
+
+/*
+ * parse and count a packet given from its IP header on, alerts go to the
+ * output ring, which only takes one thread at a time
+ */
+static void
+add_ip(const struct pcap_pkthdr *header, const u_char *l3, int len, int alerts)
+{
+        static int count = 1;                   /* packet counter */
+        struct pkt_features pf;
+        int ret;
+        STAT_TIMER(t);
+
+        window_tick(header->ts.tv_sec);
+
+        //printf("\rPacket number %d:", count);
+        if (alerts)
+                out_alert("\nPacket number %d:\n", count++);
+
+        ret = parse_count(l3, len, &pf);
+        if (alerts) switch (ret) {
+                case PARSE_BAD_IP:
+                        out_alert("   * Invalid IP header length: %u bytes\n", pf.bad_len);
+                        break;
+                case PARSE_BAD_TCP:
+                        out_alert("   * Invalid TCP header length: %u bytes\n", pf.bad_len);
+                        break;
+                case PARSE_OVERSIZED:
+                        out_alert("PACKET OVERSIZED: %d bytes\n", pf.bad_len);
+                        break;
+                case PARSE_TRUNCATED:
+                        out_alert("   * Truncated header: %d bytes captured\n", pf.bad_len);
+                        break;
+        }
+
+        STAT_START(t);
+        hist_add(&pf);
+        STAT_LAP(t, STAGE_HIST);
 
 return;
 }
 
-int live(int argc, char **argv)
+void
+got_ip(const struct pcap_pkthdr *header, const u_char *l3, int len)
 {
-    char *dev = NULL;                   /* capture device name */
-    char errbuf[PCAP_ERRBUF_SIZE];              /* error buffer */
-    pcap_t *handle;                             /* packet capture handle */
+        add_ip(header, l3, len, 1);
+}
 
-    char filter_exp[] = "ip";           /* filter expression [3] */
-    struct bpf_program fp;                      /* compiled filter program (expression) */
-    bpf_u_int32 mask;                   /* subnet mask */
-    bpf_u_int32 net;                    /* ip */
-    int num_packets = 10;                       /* number of packets to capture */
+void
+count_ip(const struct pcap_pkthdr *header, const u_char *l3, int len)
+{
+        add_ip(header, l3, len, 0);
+}
 
-    print_app_banner();
+void
+sample_ip(const struct pcap_pkthdr *header, const u_char *l3, int len)
+{
+        struct pkt_features pf;
+
+        parse_ip(l3, len, &pf);
+        bins_sample(&pf);
+}
+
+// flatten a closed window into vec, which must hold FEATURE_LEN ints,
+// only the bins in use are copied, returns the vector length
+int feature_vec(int *vec, const struct hist *h)
+{
+    int *v = vec;
+
+    memcpy(v, h->src_ip_addrs, addr_bins.nbins*sizeof(int));
+    v += addr_bins.nbins;
+    memcpy(v, h->dst_ip_addrs, addr_bins.nbins*sizeof(int));
+    v += addr_bins.nbins;
+    memcpy(v, h->src_ports, port_bins.nbins*sizeof(int));
+    v += port_bins.nbins;
+    memcpy(v, h->dst_ports, port_bins.nbins*sizeof(int));
+    v += port_bins.nbins;
+    memcpy(v, h->protocols, sizeof(h->protocols));
+    v += 4;
+    memcpy(v, h->packet_sizes, size_bins.nbins*sizeof(int));
+    v += size_bins.nbins;
+    memcpy(v, h->flags, sizeof(h->flags));
+    v += 256;
+
+    return v - vec;
+}
+
+// length of the feature vectors with the current binning
+int feature_len(void)
+{
+    return 2*addr_bins.nbins + 2*port_bins.nbins + 4 + size_bins.nbins + 256;
+}
 
-    /* check for capture device name on command-line */
-    if (argc == 2) {
-        dev = argv[1];
+// fingerprint of the feature vector layout, vectors are only comparable
+// when the binning that made them is the same
+uint64_t feature_layout(void)
+{
+    const struct binning *b[2] = { &size_bins, &port_bins };
+    uint64_t h = 14695981039346656037ULL;   // FNV-1a
+    uint32_t v[4 + BIN_MAX_EDGES];
+    int i, j, n;
+
+    for (i = 0; i < 2; i++)
+    {
+        v[0] = b[i]->mode;
+        v[1] = b[i]->nbins;
+        v[2] = b[i]->range;
+        v[3] = b[i]->width;
+        n = 4;
+        if (b[i]->mode != BIN_FIXED)
+            for (j = 0; j < b[i]->nbins; j++)
+                v[n++] = b[i]->edges[j];
+
+        for (j = 0; j < n*4; j++)
+        {
+            h ^= ((unsigned char *)v)[j];
+            h *= 1099511628211ULL;
+        }
     }
-    else if (argc > 2) {
-        fprintf(stderr, "error: unrecognized command-line options\n\n");
-        print_app_usage();
-        exit(EXIT_FAILURE);
+
+    // prefix groups, the rules are in the order lpm_build() sorted them
+    for (i = 0; addr_bins.names && i < addr_bins.lpm.nrules; i++)
+    {
+        v[0] = addr_bins.lpm.rules[i].prefix;
+        v[1] = addr_bins.lpm.rules[i].len;
+        v[2] = addr_bins.lpm.rules[i].value;
+        for (j = 0; j < 3*4; j++)
+        {
+            h ^= ((unsigned char *)v)[j];
+            h *= 1099511628211ULL;
+        }
     }
-    else {
-        /* find a capture device if not specified on command-line */
-        dev = pcap_lookupdev(errbuf);
-        if (dev == NULL) {
-            fprintf(stderr, "Couldn't find default device: %s\n",
-                    errbuf);
+
+    return h;
+}
+
+// start of every feature in the vector plus the end, bounds needs room
+// for 8 entries, returns the number of features.  Bit i of *ordered is set
+// for the features binned by value, sizes and ports: last octets, prefix
+// groups, protocols and flag combinations are only labels
+int feature_bounds(int *bounds, unsigned int *ordered)
+{
+    int len[7] = { addr_bins.nbins, addr_bins.nbins, port_bins.nbins, port_bins.nbins,
+                   4, size_bins.nbins, 256 };
+    int i;
+
+    bounds[0] = 0;
+    for (i = 0; i < 7; i++)
+        bounds[i + 1] = bounds[i] + len[i];
+    *ordered = 1u << 2 | 1u << 3 | 1u << 5;
+
+    return 7;
+}
+
+// room for one more window in ws, returns the (uninitialized) vector.  The
+// vectors come from the set's arena, a long history ends up in huge pages
+// while a tenant with a handful of windows doesn't take a whole one
+int *window_set_add(struct window_set *ws, long start)
+{
+    if (ws->n == ws->cap)
+    {
+        ws->cap = ws->cap ? 2*ws->cap : 64;
+        ws->vecs = realloc(ws->vecs, ws->cap*sizeof(int*));
+        ws->start = realloc(ws->start, ws->cap*sizeof(long));
+        if (!ws->vecs || !ws->start)
+        {
+            fprintf(stderr, "ERROR! window_set_add: out of memory\n");
             exit(EXIT_FAILURE);
         }
     }
 
-    /* get network number and mask associated with capture device */
-    if (pcap_lookupnet(dev, &net, &mask, errbuf) == -1) {
-        fprintf(stderr, "Couldn't get netmask for device %s: %s\n",
-                dev, errbuf);
-        net = 0;
-        mask = 0;
+    ws->vecs[ws->n] = arena_alloc(&ws->arena, feature_len()*sizeof(int));
+    ws->start[ws->n] = start;
+
+    return ws->vecs[ws->n++];
+}
+
+void window_set_free(struct window_set *ws)
+{
+    arena_free(&ws->arena);
+    free(ws->vecs);
+    free(ws->start);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// keep every tenant's feature vector of a closed window, a tenant's
+// windows start with the first one it had traffic in
+void window_keep(long start, const struct hist *h)
+{
+    struct window_set *ws;
+    const int *src;
+    int *dst;
+    int i, t, any;
+
+    dst = (int *)&hist_total;
+    for (t = 0; t < num_tenants; t++)
+    {
+        src = (const int *)&h[t];
+        ws = &tenants[t].windows;
+
+        for (i = 0, any = 0; i < FEATURE_LEN; i++)
+        {
+            dst[i] += src[i];
+            any |= src[i];
+        }
+
+        if (any || ws->n > 0 || t == 0)
+            feature_vec(window_set_add(ws, start), &h[t]);
     }
+}
 
-    /* print capture info */
-    printf("Device: %s\n", dev);
-    printf("Number of packets: %d\n", num_packets);
-    printf("Filter expression: %s\n", filter_exp);
+// close the current window and hand it on, to the pipeline's vectorize stage
+// if it is running
+static void window_store(long start)
+{
+    static struct hist *h;
 
-    /* open capture device */
-    handle = pcap_open_live(dev, SNAP_LEN, 1, 1000, errbuf);
-    if (handle == NULL) {
-        fprintf(stderr, "Couldn't open device %s: %s\n", dev, errbuf);
+    if (!h && (h = malloc(num_tenants*sizeof(*h))) == NULL)
+    {
+        fprintf(stderr, "ERROR! hbtad: out of memory\n");
         exit(EXIT_FAILURE);
     }
 
-    /* make sure we're capturing on an Ethernet device [2] */
-    if (pcap_datalink(handle) != DLT_EN10MB) {
-        fprintf(stderr, "%s is not an Ethernet\n", dev);
-        exit(EXIT_FAILURE);
+    window_close(h);
+
+    if (pipeline_window(start, h) != 0)
+        window_keep(start, h);
+}
+
+// close every window that ends at or before capture time ts
+void window_tick(long ts)
+{
+    if (window_secs <= 0)
+        return;
+
+    if (win_start < 0)
+    {
+        win_start = ts - ts % window_secs;
+        return;
+    }
+
+    // a big jump in capture time, don't fill it with empty windows
+    if ((ts - win_start)/window_secs > WINDOW_MAX_GAP)
+    {
+        window_store(win_start);
+        win_start = ts - ts % window_secs;
+        return;
+    }
+
+    while (ts >= win_start + window_secs)
+    {
+        window_store(win_start);
+        win_start += window_secs;
     }
+}
+
+// close the last, partial window at the end of a capture
+void window_flush(void)
+{
+    window_store(win_start < 0 ? 0 : win_start);
+    win_start = -1;
+}
+
+static pcap_t *live_handle;
+
+static void live_on_signal(int sig)
+{
+    pcap_breakloop(live_handle);
+}
+
+/* install capture.filter, or the default for the handle's link type, on
+ * handle, net is the device's network or PCAP_NETMASK_UNKNOWN */
+void set_filter(pcap_t *handle, bpf_u_int32 net)
+{
+    struct bpf_program fp;                      /* compiled filter program (expression) */
+    const char *filter = capture.filter ? capture.filter
+                                        : link_filter(pcap_datalink(handle));
 
     /* compile the filter expression */
-    if (pcap_compile(handle, &fp, filter_exp, 0, net) == -1) {
+    if (pcap_compile(handle, &fp, filter, 1, net) == -1) {
         fprintf(stderr, "Couldn't parse filter %s: %s\n",
-                filter_exp, pcap_geterr(handle));
+                filter, pcap_geterr(handle));
         exit(EXIT_FAILURE);
     }
 
     /* apply the compiled filter */
     if (pcap_setfilter(handle, &fp) == -1) {
         fprintf(stderr, "Couldn't install filter %s: %s\n",
-                filter_exp, pcap_geterr(handle));
+                filter, pcap_geterr(handle));
         exit(EXIT_FAILURE);
     }
 
-    /* now we can set our callback function */
-    pcap_loop(handle, num_packets, got_packet, NULL);
-
-    /* cleanup */
     pcap_freecode(&fp);
-    pcap_close(handle);
-
-    printf("\nCapture complete.\n");
-
-    return 0;
 }
 
-int load(int argc, char **argv)
+int live(const char *dev)
 {
-    char *dev = NULL;                   /* capture device name */
     char errbuf[PCAP_ERRBUF_SIZE];              /* error buffer */
     pcap_t *handle;                             /* packet capture handle */
-
-    char filter_exp[] = "ip";           /* filter expression [3] */
-    struct bpf_program fp;                      /* compiled filter program (expression) */
     bpf_u_int32 mask;                   /* subnet mask */
     bpf_u_int32 net;                    /* ip */
-    int num_packets = 0;                       /* number of packets to capture */
-    int i;
+    int err;
 
-    //int src_ip_addrs[256];
+    print_app_banner();
 
-    //print_app_banner();
+    /* get network number and mask associated with capture device */
+    if (pcap_lookupnet(dev, &net, &mask, errbuf) == -1) {
+        fprintf(stderr, "Couldn't get netmask for device %s: %s\n",
+                dev, errbuf);
+        net = PCAP_NETMASK_UNKNOWN;
+    }
 
-    /* check for capture device name on command-line */
-    if (argc == 2) {
-        dev = argv[1];
+    /* print capture info */
+    out_printf("Device: %s\n", dev);
+    if (capture.count)
+        out_printf("Number of packets: %d\n", capture.count);
+    out_printf("Filter expression: %s\n",
+               capture.filter ? capture.filter : link_filter(DLT_EN10MB));
+
+    /* open capture device, the buffer and snaplen are the throughput knobs */
+    if ((handle = pcap_create(dev, errbuf)) == NULL) {
+        fprintf(stderr, "Couldn't open device %s: %s\n", dev, errbuf);
+        exit(EXIT_FAILURE);
     }
-    else {
-        fprintf(stderr, "error: unrecognized command-line options\n\n");
-        print_app_usage();
+    pcap_set_snaplen(handle, capture.snaplen);
+    pcap_set_promisc(handle, 1);
+    pcap_set_timeout(handle, capture.timeout_ms);
+    pcap_set_immediate_mode(handle, capture.immediate);
+    if (capture.buffer_kib)
+        pcap_set_buffer_size(handle, capture.buffer_kib*1024);
+
+    if ((err = pcap_activate(handle)) < 0) {
+        fprintf(stderr, "Couldn't activate %s: %s\n", dev,
+                err == PCAP_ERROR ? pcap_geterr(handle) : pcap_statustostr(err));
         exit(EXIT_FAILURE);
     }
+    else if (err > 0)
+        fprintf(stderr, "warning: %s: %s\n", dev, pcap_statustostr(err));
 
-    // setup data values
-    for (i = 0; i < 256; i++)
-    {
-      src_ip_addrs[i] = 0;
-      dst_ip_addrs[i] = 0;
+    /* make sure we're capturing on an Ethernet device [2] */
+    if (pcap_datalink(handle) != DLT_EN10MB) {
+        fprintf(stderr, "%s is not an Ethernet\n", dev);
+        exit(EXIT_FAILURE);
     }
 
-    for (i = 0; i < 1024; i++)
-    {
-      src_ports[i] = 0;
-      dst_ports[i] = 0;
-    }
+    set_filter(handle, net);
 
-    for (i = 0; i < 4; i++)
-    {
-      protocols[i] = 0;
-    }
+    /* no sampling pass on a live capture, quantile bins fall back to log */
+    bins_learn_sampled();
 
-    for (i = 0; i < SNAP_LEN; i++)
-    {
-      packet_sizes[i] = 0;
-    }
+    hist_reset();
 
-    for (i = 0; i < 256; i++)
-    {
-      flags[i] = 0;
-    }
+    /* capture until count packets or an interrupt */
+    live_handle = handle;
+    signal(SIGINT, live_on_signal);
+    signal(SIGTERM, live_on_signal);
 
-    if ((handle = pcap_open_offline(dev, errbuf)) == NULL)
+    if (capture.pipeline && pipeline_start() != 0)
     {
-        printf("Unable to open the file");
+        pcap_close(handle);
         return -1;
     }
-
-    /* compile the filter expression */
-    if (pcap_compile(handle, &fp, filter_exp, 0, net) == -1) {
-        fprintf(stderr, "Couldn't parse filter %s: %s\n",
-                filter_exp, pcap_geterr(handle));
-        exit(EXIT_FAILURE);
-    }
-
-    /* apply the compiled filter */
-    if (pcap_setfilter(handle, &fp) == -1) {
-        fprintf(stderr, "Couldn't install filter %s: %s\n",
-                filter_exp, pcap_geterr(handle));
-        exit(EXIT_FAILURE);
-    }
+    affinity_capture_start();
 
     /* now we can set our callback function */
-    pcap_loop(handle, num_packets, got_packet, NULL);
+    pcap_loop(handle, capture.count ? capture.count : -1,
+              capture.pipeline ? pipeline_packet : got_packet, NULL);
+    pipeline_stop();
+    affinity_capture_stop();
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
 
     /* cleanup */
-    pcap_freecode(&fp);
     pcap_close(handle);
 
-    printf("\nCapture complete.\n");
+    out_printf("\nCapture complete.\n");
 
     return 0;
 }
 
-// normalized euclidean distance between two vectors
-float n_e_d(int *vec1, int *vec2, int len)
+static volatile sig_atomic_t xdp_stop;
+
+static void xdp_on_signal(int sig)
 {
-  int i;
-  float d = 0;
-  float sd = 0;
-  float vals[2];
+    xdp_stop = 1;
+}
 
-  for (i = 0; i < len; i++)
-  {
-    vals[0] = vec1[i];
-    vals[1] = vec2[i];
-    sd = std_dev(vals, 2);
-    d += sqrt(pow(abs(vec1[i] - vec2[i]), 2)/pow(sd,2));
-  }
+/*
+ * live capture with the histograms kept in the kernel, see xdp.h.  Reads
+ * the maps once a second until interrupted, windows follow the wall clock
+ */
+int xdp_live(const char *dev, const char *obj, const char *mode)
+{
+    struct xdp_hist delta;
+    struct xdp_counters n;
+
+    if (xdp_open(dev, obj, mode) != 0)
+        return -1;
+
+    /* no sampling pass on a live capture, quantile bins fall back to log */
+    bins_learn_sampled();
+
+    out_printf("Device: %s\n", dev);
+    out_printf("Counting in the kernel, interrupt to stop\n");
+
+    signal(SIGINT, xdp_on_signal);
+    signal(SIGTERM, xdp_on_signal);
 
-  return d;
+    hist_reset();
+    window_tick(time(NULL));
+
+    // counts read at a window boundary still go into the window it closes
+    while (!xdp_stop)
+    {
+        sleep(1);
+        if (xdp_read(&delta, &n) != 0)
+            break;
+
+        hist_add_counts((const struct hist *)&delta);
+        STAT_ADD(STAT_PACKETS, n.n[XDP_PACKETS]);
+        STAT_ADD(STAT_INVALID_IP, n.n[XDP_INVALID_IP]);
+        STAT_ADD(STAT_INVALID_TCP, n.n[XDP_INVALID_TCP]);
+        STAT_ADD(STAT_OVERSIZED, n.n[XDP_OVERSIZED]);
+
+        window_tick(time(NULL));
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    xdp_close();
+
+    out_printf("\nCapture complete.\n");
+
+    return 0;
+}
+
+int load(char **paths, int npaths)
+{
+    char **files;
+    int n, pass, ret = 0;
+
+    if ((n = replay_files(paths, npaths, &files)) < 0)
+        return -1;
+
+    hist_reset();
+
+    affinity_capture_start();
+
+    /* quantile bins are learned from a first pass over the files */
+    for (pass = bins_need_sample() ? 0 : 1; pass < 2 && ret == 0; pass++)
+    {
+        if (pass == 1 && capture.pipeline)
+        {
+            if ((ret = pipeline_start()) == 0)
+                ret = replay(files, n, pipeline_ip, capture.speed);
+            pipeline_stop();
+        }
+        /* without windows the order doesn't matter, count files side by side */
+        else if (pass == 1 && window_secs <= 0 && capture.threads > 1 && n > 1 && capture.speed == 0)
+            ret = replay_parallel(files, n, count_ip);
+        else if (pass == 0)
+            ret = replay(files, n, sample_ip, 0);
+        else
+            ret = replay(files, n, got_ip, capture.speed);
+
+        if (ret == 0 && pass == 0)
+            bins_learn_sampled();
+    }
+
+    affinity_capture_stop();
+    replay_free(files, n);
+    if (ret != 0)
+        return -1;
+
+    out_printf("\nCapture complete.\n");
+
+    return 0;
+}
+
+// normalized euclidean distance between two vectors
+// the original distance, sum over components of |a-b|/sd(a,b), sd of two
+// values is |a-b|/2 so it comes down to 2 for every component that differs,
+// and it used to be 0/0 = NaN for the ones that don't
+float n_e_d(float *vec1, float *vec2, int len)
+{
+  return dist_ned(vec1, vec2, len);
 }
 
 /*float std_dev_mult(int **vectors, int num_vecs, int vec_len)
@@ -759,104 +1100,331 @@ float std_dev(float *vals, int n)
   return sqrt(variance);
 }
 
-// kmeans impl, returns mapping of idx of array to cluster, make sure to free it{
-int *kmeans(int **vecs, int num_vecs, int vec_len, int num_clusters)
+static void assign(const struct matrix *vecs, int lo, int hi, const struct matrix *centroids, int *idx, float *dist);
+
+/*
+ * Lloyd iterations from whatever is in centroids.  With a prior, centroid
+ * i is the weighted mean of prior row i (weight weights[i], the windows it
+ * already stands for) and the vectors assigned to it, so a model can be
+ * moved along by new windows alone.
+ */
+static int *kmeans_iterate(const struct matrix *vecs, struct matrix *centroids,
+                           const struct matrix *prior, const double *weights, struct arena *a)
 {
     int *map;   // store mapping of vectors to a cluster
-    int i,j;
-    int **mean_vecs;  // centroids
-    int dist, min_dist, min_centroid;
-    int **tmp_vecs;  // place to hold pointers to current vecs that need to compute centroid
-    int tmp_vecs_idx; // to keep track of count
-
-    if (num_vecs < num_clusters)
+    int *near;  // nearest centroid this round
+    int *count;
+    double *sum, w;
+    const float *v, *p;
+    float *c;
+    int i, j, n = vecs->rows, len = vecs->cols, k = centroids->rows;
+    int iter, changed;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+
+    map = arena_alloc(a, n*sizeof(int));
+    near = arena_alloc(scratch, n*sizeof(int));
+    count = arena_alloc(scratch, k*sizeof(int));
+    sum = arena_alloc(scratch, (size_t)k*len*sizeof(double));
+
+    for (i = 0; i < n; i++)
+        map[i] = -1;
+
+    for (iter = 0; iter < KMEANS_MAX_ITER; iter++)
     {
-        printf("ERROR! kmeans: num_vecs < num_clusters\n");
-        return NULL;
-    }
+        STAT_INC(STAT_KMEANS_ITERS);
+        changed = 0;
 
-    map = malloc(num_vecs*sizeof(int));
-    mean_vecs = malloc(num_clusters*vec_len*sizeof(int));
-    tmp_vecs = malloc(num_vecs*sizeof(int*));
-
-    // assume the first n vecs are the initial centroids
-    for (i = 0; i < num_clusters; i++)
-    {
-        for (j = 0; j < vec_len; j++)
+        // assign each vector to a cluster by distance
+        assign(vecs, 0, n, centroids, near, NULL);
+        for (i = 0; i < n; i++)
         {
-            mean_vecs[i][j] = vecs[i][j];
+            if (map[i] != near[i])
+            {
+                map[i] = near[i];
+                changed++;
+            }
         }
-    }
 
-    min_dist = INT_MAX;
+        if (!changed)
+            break;
 
-    // assign each vector to a cluster by distance
-    for (i = 0; i < num_vecs; i++)
-    {
-        for (j = 0; j < num_clusters; j++)
+        // compute new centroids, one pass over the vectors, summed in double
+        memset(count, 0, k*sizeof(int));
+        memset(sum, 0, (size_t)k*len*sizeof(double));
+        for (i = 0; i < n; i++)
         {
-            dist = n_e_d(vecs[i], mean_vecs[j], vec_len);
+            v = matrix_row(vecs, i);
+            count[map[i]]++;
+            for (j = 0; j < len; j++)
+                sum[(size_t)map[i]*len + j] += v[j];
+        }
 
-            if (dist < min_dist)
-            {
-                dist = min_dist;
-                min_centroid = j;
-            }
+        for (i = 0; i < k; i++)
+        {
+            w = prior ? weights[i] : 0;
+
+            // empty cluster, keep the old centroid
+            if (count[i] == 0 && w == 0)
+                continue;
+
+            c = matrix_row(centroids, i);
+            p = prior ? matrix_row(prior, i) : NULL;
+            for (j = 0; j < len; j++)
+                c[j] = (sum[(size_t)i*len + j] + (p ? w*p[j] : 0))/(count[i] + w);
         }
+    }
+
+    arena_release(scratch, mark);
+
+    return map;
+}
+
+// kmeans impl, returns mapping of idx of array to cluster, allocated in a
+// centroids must have num_clusters rows of vecs->cols, the final centroids end up there
+int *kmeans(const struct matrix *vecs, int num_clusters, struct matrix *centroids, struct arena *a)
+{
+    int *map;
+    int i;
+    STAT_TIMER(t);
 
-        map[i] = min_centroid;
+    if (vecs->rows < num_clusters)
+    {
+        out_printf("ERROR! kmeans: num_vecs < num_clusters\n");
+        return NULL;
     }
 
-    // compute new centroids
+    if (vecs->rows == 0 || num_clusters == 0)
+        return NULL;
+
+    STAT_START(t);
+
+    // assume the first n vecs are the initial centroids
     for (i = 0; i < num_clusters; i++)
-    {
-        tmp_vecs_idx = 0;
+        memcpy(matrix_row(centroids, i), matrix_row(vecs, i), vecs->cols*sizeof(float));
 
-        for (j = 0; j < num_vecs; j++)
-        {
-            if (map[j] == i)
-            {
-                tmp_vecs[tmp_vecs_idx] = vecs[j];
-                tmp_vecs_idx++;
-            }
-        }
+    map = kmeans_iterate(vecs, centroids, NULL, NULL, a);
 
-        mean_vec(mean_vecs[i], tmp_vecs, tmp_vecs_idx, vec_len);
-    }
+    STAT_LAP(t, STAGE_CLUSTER);
 
-  return NULL;
+    return map;
 }
 
-// calculate mean vector from a set of vectors, store in m_vec
-void mean_vec(int *m_vec, int **vecs, int num_vecs, int vec_len)
+// warm started kmeans over new windows only, centroids come in as the old
+// model and weights as the number of windows each centroid stands for;
+// both are updated.  Returns the mapping of the new windows like kmeans().
+int *kmeans_warm(const struct matrix *vecs, struct matrix *centroids, double *weights, struct arena *a)
 {
-    //int *m_vec;
-  int sum;
-  int i,j;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark;
+    struct matrix prior;
+    int *map;
+    int i;
+    STAT_TIMER(t);
 
-  m_vec = malloc(vec_len*sizeof(int));
+    if (vecs->rows == 0 || centroids->rows == 0)
+        return NULL;
 
-  for(i = 0; i < vec_len; i++)
-  {
-    sum = 0;
+    STAT_START(t);
 
-    for(j = 0; j < num_vecs; j++)
-    {
-      sum += vecs[j][i];
-    }
+    mark = arena_mark(scratch);
+    matrix_alloc_in(&prior, centroids->rows, centroids->cols, scratch);
+    memcpy(prior.data, centroids->data, (size_t)centroids->rows*centroids->stride*sizeof(float));
 
-    m_vec[i] = sum/num_vecs;
-  }
+    map = kmeans_iterate(vecs, centroids, &prior, weights, a);
+    for (i = 0; i < vecs->rows; i++)
+        weights[map[i]] += 1;
+
+    arena_release(scratch, mark);
+
+    STAT_LAP(t, STAGE_CLUSTER);
+
+    return map;
 }
 
+/*
+ * One assignment sweep per metric with the kernel inlined, the metric is
+ * switched on once per sweep.  Build with -DHBTAD_METRIC=DIST_CHI2 etc to
+ * fix it at compile time and drop the others.
+ *
+ * The sweep is blocked like a matrix multiply: a block of vectors is run
+ * against one centroid at a time, so the centroid row stays in L1 while
+ * the block reuses it.
+ */
+#define ASSIGN_BLOCK 16
+
+#define ASSIGN(kernel) \
+static void assign_##kernel(const struct matrix *vecs, int lo, int hi, const struct matrix *centroids, int *idx, float *dist) \
+{ \
+    float best[ASSIGN_BLOCK], d; \
+    const float *c; \
+    int b, i, j, n; \
+ \
+    for (b = lo; b < hi; b += ASSIGN_BLOCK) \
+    { \
+        n = hi - b < ASSIGN_BLOCK ? hi - b : ASSIGN_BLOCK; \
+        for (i = 0; i < n; i++) \
+        { \
+            best[i] = INFINITY; \
+            idx[b + i] = 0; \
+        } \
+ \
+        for (j = 0; j < centroids->rows; j++) \
+        { \
+            c = matrix_row(centroids, j); \
+            for (i = 0; i < n; i++) \
+            { \
+                d = kernel(matrix_row(vecs, b + i), c, vecs->cols); \
+                if (d < best[i]) \
+                { \
+                    best[i] = d; \
+                    idx[b + i] = j; \
+                } \
+            } \
+        } \
+ \
+        if (dist) \
+            memcpy(dist + b, best, n*sizeof(float)); \
+    } \
+}
 
+ASSIGN(dist_euclid)
+ASSIGN(dist_ned)
+ASSIGN(dist_chi2)
+ASSIGN(dist_hellinger)
+ASSIGN(dist_js)
+ASSIGN(dist_emd)
 
+/*
+ * Euclidean assignment of many vectors at once as a matrix multiply,
+ * |x - c|^2 = |x|^2 + |c|^2 - 2 x.c with all the x.c from matrix_mul().
+ * Rows are done GEMM_ROWS at a time to bound the scratch space.
+ */
+#define GEMM_ROWS 240
 
+static void assign_gemm(const struct matrix *vecs, int lo, int hi, const struct matrix *centroids, int *idx, float *dist)
+{
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct matrix ct;
+    float *dots, *cn, *row, d, best;
+    int b, i, j, n, k = centroids->rows;
 
+    matrix_transpose(&ct, centroids, scratch);
+    dots = arena_alloc(scratch, (size_t)GEMM_ROWS*ct.stride*sizeof(float));
+    cn = arena_alloc(scratch, k*sizeof(float));
 
+    for (j = 0; j < k; j++)
+        cn[j] = dist_sqnorm(matrix_row(centroids, j), centroids->cols);
 
+    for (b = lo; b < hi; b += GEMM_ROWS)
+    {
+        n = hi - b < GEMM_ROWS ? hi - b : GEMM_ROWS;
+        matrix_mul(vecs, b, b + n, &ct, dots);
 
+        for (i = 0; i < n; i++)
+        {
+            row = dots + (size_t)i*ct.stride;
+            best = INFINITY;
+            idx[b + i] = 0;
+            for (j = 0; j < k; j++)
+            {
+                d = cn[j] - 2*row[j];
+                if (d < best)
+                {
+                    best = d;
+                    idx[b + i] = j;
+                }
+            }
+
+            // the expanded form cancels badly for a vector close to its
+            // centroid, redo just the winner directly
+            if (dist)
+                dist[b + i] = dist_euclid(matrix_row(vecs, b + i), matrix_row(centroids, idx[b + i]), vecs->cols);
+        }
+    }
 
+    arena_release(scratch, mark);
+}
 
+#ifdef HBTAD_METRIC
+#define METRIC HBTAD_METRIC
+#else
+#define METRIC distance_metric
+#endif
 
+// nearest centroid of vectors lo .. hi-1 into idx[i], the distance to it
+// into dist[i] unless dist is NULL
+static void assign(const struct matrix *vecs, int lo, int hi, const struct matrix *centroids, int *idx, float *dist)
+{
+    switch (METRIC)
+    {
+    case DIST_NED:
+        assign_dist_ned(vecs, lo, hi, centroids, idx, dist);
+        break;
+    case DIST_CHI2:
+        assign_dist_chi2(vecs, lo, hi, centroids, idx, dist);
+        break;
+    case DIST_HELLINGER:
+        assign_dist_hellinger(vecs, lo, hi, centroids, idx, dist);
+        break;
+    case DIST_JS:
+        assign_dist_js(vecs, lo, hi, centroids, idx, dist);
+        break;
+    case DIST_EMD:
+        assign_dist_emd(vecs, lo, hi, centroids, idx, dist);
+        break;
+    default:
+        // a single vector isn't worth the transpose
+        if (hi - lo >= ASSIGN_BLOCK)
+            assign_gemm(vecs, lo, hi, centroids, idx, dist);
+        else
+            assign_dist_euclid(vecs, lo, hi, centroids, idx, dist);
+        break;
+    }
+}
 
+// distance between two vectors with the configured metric
+float distance(const float *a, const float *b, int len)
+{
+    switch (METRIC)
+    {
+    case DIST_NED:
+        return dist_ned(a, b, len);
+    case DIST_CHI2:
+        return dist_chi2(a, b, len);
+    case DIST_HELLINGER:
+        return dist_hellinger(a, b, len);
+    case DIST_JS:
+        return dist_js(a, b, len);
+    case DIST_EMD:
+        return dist_emd(a, b, len);
+    default:
+        return dist_euclid(a, b, len);
+    }
+}
+
+// nearest centroid of every vector, see assign()
+void kmeans_assign(const struct matrix *vecs, const struct matrix *centroids, int *idx, float *dist)
+{
+    assign(vecs, 0, vecs->rows, centroids, idx, dist);
+}
+
+// classify a window against the trained centroids, returns the cluster
+int classify(const float *vec, const struct matrix *centroids, float *dist)
+{
+    // a one row view of vec, it is never written through
+    struct matrix one = { (float *)vec, 1, centroids->cols, centroids->stride };
+    int c;
+    float d;
+    STAT_TIMER(t);
+
+    STAT_START(t);
+    assign(&one, 0, 1, centroids, &c, &d);
+    STAT_LAP(t, STAGE_CLASSIFY);
+
+    if (dist)
+        *dist = d;
+
+    return c;
+}
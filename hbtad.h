@@ -0,0 +1,162 @@
+#ifndef HBTAD_H
+#define HBTAD_H
+
+#include <pcap.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* default snap length (maximum bytes per packet to capture) */
+#define SNAP_LEN 1518
+
+/* ethernet headers are always exactly 14 bytes */
+#define SIZE_ETHERNET 14
+
+/* and an 802.1Q tag between them and the IP header adds 4 */
+#define SIZE_VLAN 4
+
+// length of a full feature vector, all histograms back to back
+#define FEATURE_LEN (256 + 256 + 1024 + 1024 + 4 + SNAP_LEN + 256)
+
+// parse_packet() results
+#define PARSE_OK 0
+#define PARSE_BAD_IP -1
+#define PARSE_BAD_TCP -2
+#define PARSE_OVERSIZED -3
+#define PARSE_TRUNCATED -4
+
+// default window length in seconds
+#define WINDOW_SECS 10
+
+// most empty windows filled in for a gap in capture time
+#define WINDOW_MAX_GAP 8640
+
+// default number of clusters
+#define NUM_CLUSTERS 8
+
+// kmeans gives up after this many assignment passes
+#define KMEANS_MAX_ITER 100
+
+// one window's worth of feature histograms, all int so it is also the
+// FEATURE_LEN long feature vector
+struct hist {
+    // last octet, or prefix group with HBTAD_ADDR_PREFIXES, see addr.h
+    int src_ip_addrs[256];
+    int dst_ip_addrs[256];
+
+    // only care about ports 0-1023, binned with port_bins
+    int src_ports[1024];
+    int dst_ports[1024];
+
+    // tcp, udp, icmp, or ip
+    int protocols[4];
+
+    // binned with size_bins, room for one bin per size up to SNAP_LEN
+    int packet_sizes[SNAP_LEN];
+
+    // flags 8 flags, 256 combinations
+    int flags[256];
+};
+
+// what a single packet adds to the histograms, -1 means nothing
+struct pkt_features {
+    int src_ip;
+    int dst_ip;
+    int protocol;
+    int src_port;
+    int dst_port;
+    int flags;
+    int size;           // raw size, binned when counted
+    int bad_len;        // offending length when parse_packet() fails
+    uint32_t saddr;     // full addresses in host order, 0 if not parsed
+    uint32_t daddr;
+    int tenant;         // whose histograms it goes into, see tenant.h
+};
+
+int
+parse_packet(const struct pcap_pkthdr *header, const u_char *packet, struct pkt_features *pf);
+
+// bytes from the start of an ethernet frame of caplen bytes to its IP
+// header, one VLAN tag included
+int
+ether_l3_off(const u_char *frame, int caplen);
+
+// len is how much of the packet was captured from l3 on, nothing past
+// that is read
+int
+parse_ip(const u_char *l3, int len, struct pkt_features *pf);
+
+void
+got_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet);
+
+// the same as got_packet() and the sampling pass, from the IP header on
+void
+got_ip(const struct pcap_pkthdr *header, const u_char *l3, int len);
+
+void
+sample_ip(const struct pcap_pkthdr *header, const u_char *l3, int len);
+
+// parse_ip() and the stats and tenant that go with it
+int
+parse_count(const u_char *l3, int len, struct pkt_features *pf);
+
+// got_ip() without the alerts, for several reader threads at once
+void
+count_ip(const struct pcap_pkthdr *header, const u_char *l3, int len);
+
+// install capture.filter, net is the device's network or PCAP_NETMASK_UNKNOWN
+void
+set_filter(pcap_t *handle, bpf_u_int32 net);
+
+void
+print_payload(const u_char *payload, int len);
+
+void
+print_hex_ascii_line(const u_char *payload, int len, int offset);
+
+void
+print_app_banner(void);
+
+void
+print_app_usage(void);
+
+// closed windows, in capture time order
+struct window_set {
+    int **vecs;     // feature_len() ints each
+    long *start;    // capture time the window starts at
+    int n;
+    int cap;
+    struct arena arena;             // the vectors live here
+};
+
+extern int window_secs;
+extern struct hist hist_total;
+
+int *window_set_add(struct window_set *ws, long start);
+void window_set_free(struct window_set *ws);
+
+void window_tick(long ts);
+void window_keep(long start, const struct hist *h);
+void window_flush(void);
+
+// capture from a device or read a file, with the settings in capture
+int live(const char *dev);
+int load(char **paths, int npaths);
+int xdp_live(const char *dev, const char *obj, const char *mode);
+
+int feature_vec(int *vec, const struct hist *h);
+int feature_len(void);
+int feature_bounds(int *bounds, unsigned int *ordered);
+uint64_t feature_layout(void);
+
+float n_e_d(float *vec1, float *vec2, int len);
+float distance(const float *a, const float *b, int len);
+float std_dev_mult(int **vectors, int num_vecs, int vec_len);
+float std_dev(float *vals, int n);
+struct matrix;
+int *kmeans(const struct matrix *vecs, int num_clusters, struct matrix *centroids, struct arena *a);
+int *kmeans_warm(const struct matrix *vecs, struct matrix *centroids, double *weights, struct arena *a);
+void kmeans_assign(const struct matrix *vecs, const struct matrix *centroids, int *idx, float *dist);
+int classify(const float *vec, const struct matrix *centroids, float *dist);
+
+#endif
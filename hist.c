@@ -0,0 +1,257 @@
+/*
+ * Sharded feature histograms, see hist.h.
+ *
+ * Updates are bracketed by a per-shard sequence number, odd while an
+ * update is running.  The closer publishes the new epoch, then forces a
+ * full barrier on every thread with membarrier(2), so any update that
+ * starts after that sees the new epoch.  An update already running is
+ * waited for by watching its sequence number move.  This is the same
+ * asymmetric fence trick userspace RCU uses.  When membarrier isn't
+ * available the update side falls back to a full fence.
+ *
+ * A shard has a histogram pair per tenant, allocated by the capture
+ * thread on the tenant's first packet and published with a release store,
+ * so tenants that never show up cost one pointer per shard.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+#include "hist.h"
+#include "stats.h"
+#include "affinity.h"
+#include "bins.h"
+
+_Static_assert(sizeof(struct hist) == FEATURE_LEN*sizeof(int),
+               "struct hist must be exactly the feature vector");
+
+struct hist_pair {
+    struct hist buf[2];
+};
+
+struct hist_shard {
+    _Alignas(64) unsigned int seq;
+    struct hist_pair **tenant;      // hist_tenants entries
+};
+
+static struct hist_shard *shards[HIST_MAX_SHARDS];
+static unsigned int num_shards;
+static unsigned int hist_epoch;
+static int hist_tenants = 1;
+static int use_membarrier = -1;
+
+static __thread struct hist_shard *hist_tls;
+
+static pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void hist_init_barrier(void)
+{
+    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+
+    use_membarrier = cmds > 0
+        && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+        && syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+}
+
+static struct hist_shard *hist_register(void)
+{
+    struct hist_shard *s;
+
+    pthread_mutex_lock(&hist_lock);
+
+    if (use_membarrier < 0)
+        hist_init_barrier();
+
+    if (num_shards == HIST_MAX_SHARDS)
+    {
+        fprintf(stderr, "ERROR! hist: more than %d capture threads\n", HIST_MAX_SHARDS);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((s = aligned_alloc(64, sizeof(*s))) == NULL
+        || (memset(s, 0, sizeof(*s)), s->tenant = calloc(hist_tenants, sizeof(*s->tenant))) == NULL)
+    {
+        fprintf(stderr, "ERROR! hist: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    shards[num_shards] = s;
+    __atomic_store_n(&num_shards, num_shards + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&hist_lock);
+
+    hist_tls = s;
+
+    return s;
+}
+
+// the shards' tenant arrays are sized when they register, so the count
+// can't change once one has
+int hist_set_tenants(int n)
+{
+    pthread_mutex_lock(&hist_lock);
+    if (num_shards > 0)
+    {
+        pthread_mutex_unlock(&hist_lock);
+        fprintf(stderr, "ERROR! hist: tenants set after counting started\n");
+        return -1;
+    }
+    hist_tenants = n;
+    pthread_mutex_unlock(&hist_lock);
+
+    return 0;
+}
+
+int hist_num_tenants(void)
+{
+    return hist_tenants;
+}
+
+// called by the shard's own thread, so on its NUMA node
+static struct hist_pair *hist_tenant_alloc(struct hist_shard *s, int t)
+{
+    struct hist_pair *p = affinity_alloc(sizeof(*p), -1);
+
+    if (!p)
+    {
+        fprintf(stderr, "ERROR! hist: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // zeroed before the closer can see it
+    __atomic_store_n(&s->tenant[t], p, __ATOMIC_RELEASE);
+
+    return p;
+}
+
+void hist_add(const struct pkt_features *pf)
+{
+    struct hist_shard *s = hist_tls ? hist_tls : hist_register();
+    struct hist_pair *p = s->tenant[pf->tenant];
+    struct hist *h;
+
+    if (!p)
+        p = hist_tenant_alloc(s, pf->tenant);
+
+    // only this thread writes seq, odd means we are inside
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    if (use_membarrier)
+        __asm__ __volatile__("" ::: "memory");
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    h = &p->buf[__atomic_load_n(&hist_epoch, __ATOMIC_RELAXED) & 1];
+
+    if (pf->src_ip >= 0)
+        h->src_ip_addrs[pf->src_ip]++;
+    if (pf->dst_ip >= 0)
+        h->dst_ip_addrs[pf->dst_ip]++;
+    if (pf->protocol >= 0)
+        h->protocols[pf->protocol]++;
+    if (pf->src_port >= 0)
+        h->src_ports[bin_lookup(&port_bins, pf->src_port)]++;
+    if (pf->dst_port >= 0)
+        h->dst_ports[bin_lookup(&port_bins, pf->dst_port)]++;
+    if (pf->flags >= 0)
+        h->flags[pf->flags]++;
+    if (pf->size >= 0)
+        h->packet_sizes[bin_lookup(&size_bins, pf->size)]++;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void hist_add_counts(const struct hist *counts)
+{
+    struct hist_shard *s = hist_tls ? hist_tls : hist_register();
+    struct hist_pair *p = s->tenant[0];
+    const int *src = (const int *)counts;
+    int *dst, i;
+
+    if (!p)
+        p = hist_tenant_alloc(s, 0);
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    if (use_membarrier)
+        __asm__ __volatile__("" ::: "memory");
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    dst = (int *)&p->buf[__atomic_load_n(&hist_epoch, __ATOMIC_RELAXED) & 1];
+    for (i = 0; i < FEATURE_LEN; i++)
+        dst[i] += src[i];
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void window_close(struct hist *out)
+{
+    unsigned int old, n, i, j, seq;
+    struct hist_pair *p;
+    int *dst, *src, tn;
+    STAT_TIMER(t);
+
+    STAT_START(t);
+
+    pthread_mutex_lock(&hist_lock);
+
+    old = hist_epoch;
+    __atomic_store_n(&hist_epoch, old + 1, __ATOMIC_SEQ_CST);
+
+    if (use_membarrier > 0)
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    n = __atomic_load_n(&num_shards, __ATOMIC_ACQUIRE);
+
+    // wait out updates that may still be using the old set
+    for (i = 0; i < n; i++)
+    {
+        seq = __atomic_load_n(&shards[i]->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            while (__atomic_load_n(&shards[i]->seq, __ATOMIC_ACQUIRE) == seq)
+                sched_yield();
+    }
+
+    if (out)
+        memset(out, 0, hist_tenants*sizeof(*out));
+
+    for (i = 0; i < n; i++)
+    {
+        for (tn = 0; tn < hist_tenants; tn++)
+        {
+            if ((p = __atomic_load_n(&shards[i]->tenant[tn], __ATOMIC_ACQUIRE)) == NULL)
+                continue;
+
+            src = (int *)&p->buf[old & 1];
+
+            if (out)
+            {
+                dst = (int *)&out[tn];
+                for (j = 0; j < FEATURE_LEN; j++)
+                    dst[j] += src[j];
+            }
+
+            memset(src, 0, sizeof(struct hist));
+        }
+    }
+
+    pthread_mutex_unlock(&hist_lock);
+
+    if (out)
+    {
+        STAT_INC(STAT_WINDOWS);
+        STAT_LAP(t, STAGE_WINDOW);
+    }
+}
+
+void hist_reset(void)
+{
+    window_close(NULL);
+}
@@ -0,0 +1,38 @@
+#ifndef HIST_H
+#define HIST_H
+
+/*
+ * Sharded feature histograms.
+ *
+ * Each capture thread counts into its own shard with plain increments, no
+ * atomics and no shared cache lines.  A shard holds two histogram sets
+ * and the global window epoch picks which one is live.  window_close()
+ * bumps the epoch, waits for any update still running against the old
+ * set, then merges and clears the old sets of all shards.  Capture
+ * threads never stop; they just start counting into the other set.
+ */
+
+#include "hbtad.h"
+
+// most capture threads we'll ever shard for
+#define HIST_MAX_SHARDS 64
+
+// number of tenants counted separately.  Only before the first packet,
+// once any thread has counted it fails with -1, else 0
+int hist_set_tenants(int n);
+int hist_num_tenants(void);
+
+// add a parsed packet to its tenant's histograms in the calling thread's shard
+void hist_add(const struct pkt_features *pf);
+
+// add counts aggregated elsewhere (the kernel, see xdp.h) to tenant 0
+void hist_add_counts(const struct hist *counts);
+
+// close the current window, merged counts of all shards go into out,
+// which holds one hist per tenant
+void window_close(struct hist *out);
+
+// throw away everything counted so far
+void hist_reset(void);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * DIR-24-8 longest prefix match, see lpm.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "affinity.h"
+#include "lpm.h"
+
+int lpm_add(struct lpm *l, uint32_t prefix, int len, int value)
+{
+    if (len < 0 || len > 32 || value < 1 || value > LPM_MAX_VALUE)
+    {
+        fprintf(stderr, "ERROR! lpm: bad rule /%d -> %d\n", len, value);
+        return -1;
+    }
+
+    if (l->nrules == l->rules_cap)
+    {
+        l->rules_cap = l->rules_cap ? 2*l->rules_cap : 64;
+        if ((l->rules = realloc(l->rules, l->rules_cap*sizeof(*l->rules))) == NULL)
+        {
+            fprintf(stderr, "ERROR! lpm: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    l->rules[l->nrules].prefix = len ? prefix & (0xffffffffu << (32 - len)) : 0;
+    l->rules[l->nrules].len = len;
+    l->rules[l->nrules].value = value;
+    l->rules[l->nrules].seq = l->nrules;
+    l->nrules++;
+
+    return 0;
+}
+
+// shorter prefixes first so longer ones overwrite them, then in the order
+// added so later rules overwrite earlier ones
+static int cmp_rule(const void *a, const void *b)
+{
+    const struct lpm_rule *x = a, *y = b;
+
+    if (x->len != y->len)
+        return x->len - y->len;
+    return x->seq - y->seq;
+}
+
+static int lpm_group(struct lpm *l, unsigned int fill)
+{
+    int i;
+
+    if (l->groups == LPM_MAX_GROUPS)
+    {
+        fprintf(stderr, "ERROR! lpm: more than %d /24s with longer prefixes\n", LPM_MAX_GROUPS);
+        return -1;
+    }
+
+    if (l->groups == l->groups_cap)
+    {
+        l->groups_cap = l->groups_cap ? 2*l->groups_cap : 16;
+        if ((l->tbl8 = realloc(l->tbl8, (size_t)l->groups_cap*256*sizeof(uint16_t))) == NULL)
+        {
+            fprintf(stderr, "ERROR! lpm: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < 256; i++)
+        l->tbl8[(size_t)l->groups*256 + i] = fill;
+
+    return l->groups++;
+}
+
+int lpm_build(struct lpm *l)
+{
+    const struct lpm_rule *r;
+    uint32_t i, lo, n;
+    unsigned int e;
+    int k, g;
+
+    // zero pages cost nothing until a rule covers them, every lookup lands
+    // somewhere else in it so it gets huge pages if they're on
+    if (!l->tbl24 && (l->tbl24 = affinity_alloc((1 << 24)*sizeof(uint16_t), -1)) == NULL)
+    {
+        fprintf(stderr, "ERROR! lpm: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    qsort(l->rules, l->nrules, sizeof(*l->rules), cmp_rule);
+
+    for (k = 0; k < l->nrules; k++)
+    {
+        r = &l->rules[k];
+
+        if (r->len <= 24)
+        {
+            // sorted by length, so no /24 has a tbl8 group yet
+            lo = r->prefix >> 8;
+            n = 1u << (24 - r->len);
+            for (i = 0; i < n; i++)
+                l->tbl24[lo + i] = r->value;
+            continue;
+        }
+
+        e = l->tbl24[r->prefix >> 8];
+        if (!(e & LPM_EXT))
+        {
+            if ((g = lpm_group(l, e)) < 0)
+                return -1;
+            e = LPM_EXT | g;
+            l->tbl24[r->prefix >> 8] = e;
+        }
+
+        lo = ((e & ~LPM_EXT) << 8) | (r->prefix & 0xff);
+        n = 1u << (32 - r->len);
+        for (i = 0; i < n; i++)
+            l->tbl8[lo + i] = r->value;
+    }
+
+    return 0;
+}
+
+int lpm_parse(const char *s, uint32_t *prefix, int *len)
+{
+    char buf[32], *slash, *end;
+    struct in_addr a;
+    long n = 32;
+
+    if (strlen(s) >= sizeof(buf))
+        return -1;
+    strcpy(buf, s);
+
+    if ((slash = strchr(buf, '/')) != NULL)
+    {
+        *slash = '\0';
+        n = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || end == slash + 1 || n < 0 || n > 32)
+            return -1;
+    }
+
+    if (inet_pton(AF_INET, buf, &a) != 1)
+        return -1;
+
+    *prefix = ntohl(a.s_addr);
+    *len = n;
+
+    return 0;
+}
+
+int lpm_read(struct lpm *l, const char *path, int first, int max,
+             char (**names)[LPM_NAME_LEN])
+{
+    char line[4096], *tok, *save, *hash;
+    char (*nm)[LPM_NAME_LEN] = NULL;
+    uint32_t prefix;
+    int len, n = 0, cap = 0, lineno = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR! lpm: unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if ((hash = strchr(line, '#')) != NULL)
+            *hash = '\0';
+
+        if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL)
+            continue;
+
+        if (n == max || first + n > LPM_MAX_VALUE)
+        {
+            fprintf(stderr, "ERROR! lpm: %s: more than %d names\n", path, n);
+            goto fail;
+        }
+
+        if (n == cap)
+        {
+            cap = cap ? 2*cap : 16;
+            if ((nm = realloc(nm, cap*sizeof(*nm))) == NULL)
+            {
+                fprintf(stderr, "ERROR! lpm: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        snprintf(nm[n], sizeof(nm[n]), "%s", tok);
+
+        while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            if (lpm_parse(tok, &prefix, &len) != 0)
+            {
+                fprintf(stderr, "ERROR! lpm: %s:%d: bad prefix '%s'\n", path, lineno, tok);
+                goto fail;
+            }
+            if (lpm_add(l, prefix, len, first + n) != 0)
+            {
+                fprintf(stderr, "ERROR! lpm: %s:%d: unable to add '%s'\n", path, lineno, tok);
+                goto fail;
+            }
+        }
+
+        n++;
+    }
+    fclose(fp);
+
+    if (lpm_build(l) != 0)
+    {
+        free(nm);
+        return -1;
+    }
+
+    *names = nm;
+    return n;
+
+fail:
+    fclose(fp);
+    free(nm);
+    return -1;
+}
+
+void lpm_free(struct lpm *l)
+{
+    affinity_free(l->tbl24, (1 << 24)*sizeof(uint16_t));
+    free(l->tbl8);
+    free(l->rules);
+    memset(l, 0, sizeof(*l));
+}
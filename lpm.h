@@ -0,0 +1,70 @@
+#ifndef LPM_H
+#define LPM_H
+
+/*
+ * IPv4 longest prefix match, DIR-24-8.
+ *
+ * tbl24 has an entry for every /24.  Prefixes up to /24 are expanded
+ * straight into it, so most lookups are a single load.  A /24 that holds
+ * longer prefixes points at a group of 256 tbl8 entries instead, one per
+ * address, for a second load.  Values are 1 .. LPM_MAX_VALUE, 0 is no
+ * match.  Tables are built once from all rules, there are no deletes.
+ *
+ * tbl24 is 32 MB whatever the rules, so every table costs that much
+ * resident memory: the tenants and the address prefixes together take
+ * 64 MB before the first tbl8 group.
+ */
+
+#include <stdint.h>
+
+#define LPM_MAX_VALUE 0x7fff
+#define LPM_EXT 0x8000              // tbl24 entry is a tbl8 group index
+#define LPM_MAX_GROUPS 0x8000
+#define LPM_NAME_LEN 64
+
+struct lpm_rule {
+    uint32_t prefix;                // host order, bits past len are zero
+    int len;
+    int value;
+    int seq;                        // order added, breaks ties in lpm_build()
+};
+
+struct lpm {
+    uint16_t *tbl24;                // 1 << 24 entries
+    uint16_t *tbl8;                 // groups of 256
+    int groups;
+    int groups_cap;
+
+    struct lpm_rule *rules;
+    int nrules;
+    int rules_cap;
+};
+
+// queue a rule, addresses in host order
+int lpm_add(struct lpm *l, uint32_t prefix, int len, int value);
+
+// fill the tables from the rules, later rules win between equal prefixes
+int lpm_build(struct lpm *l);
+
+// "10.1.0.0/16" or a bare address for a /32, 0 on success
+int lpm_parse(const char *s, uint32_t *prefix, int *len);
+
+// read a file of "name prefix ..." lines, '#' starts a comment.  The
+// prefixes of the i-th name map to first + i, at most max names.  Builds
+// the tables and returns the number of names, which go into *names, or -1
+int lpm_read(struct lpm *l, const char *path, int first, int max,
+             char (**names)[LPM_NAME_LEN]);
+
+void lpm_free(struct lpm *l);
+
+static inline int lpm_lookup(const struct lpm *l, uint32_t addr)
+{
+    unsigned int e = l->tbl24[addr >> 8];
+
+    if (e & LPM_EXT)
+        e = l->tbl8[((e & ~LPM_EXT) << 8) | (addr & 0xff)];
+
+    return e;
+}
+
+#endif
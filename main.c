@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "hbtad.h"
+#include "output.h"
+#include "stats.h"
+#include "hist.h"
+#include "bins.h"
+#include "addr.h"
+#include "proj.h"
+#include "distance.h"
+#include "matrix.h"
+#include "store.h"
+#include "model.h"
+#include "tenant.h"
+#include "config.h"
+
+// what to do with each tenant's windows
+struct detect_cfg {
+  struct projection proj;       // mode and size only, learned per tenant
+  int num_clusters;
+  const char *store_dir;
+  int train_secs;               // 0 to train on this capture
+  const char *model_path;
+  int retrain;
+};
+
+// what a training run allocates, reset by each one, see arena.h
+static struct arena run;
+
+/*
+ * store, train and classify one tenant's windows, 0 on success
+ *
+ * With tenants configured each one keeps its history in its own
+ * subdirectory of the store and its model in <model>.<name>.
+ */
+static int detect(struct tenant *tn, const struct detect_cfg *cfg)
+{
+  struct projection proj = cfg->proj;
+  struct matrix mapped, trained, centroids;
+  struct matrix *tm = &mapped;
+  struct window_set *windows = &tn->windows;
+  struct window_set history = { 0 };
+  struct window_set *train = windows;
+  struct store store;
+  struct model model = { 0 };
+  char store_buf[4096], model_buf[4096];
+  const char *store_dir = cfg->store_dir;
+  const char *model_path = cfg->model_path;
+  long last;
+  int warm = 0;
+  int *map, *sizes;
+  int i, k, c, len;
+  float dist;
+
+  arena_reset(&run);
+
+  if (num_tenants > 1)
+  {
+    out_printf("Tenant %s..\n", tn->name);
+
+    if (store_dir)
+    {
+      if (mkdir(store_dir, 0755) != 0 && errno != EEXIST)
+      {
+        fprintf(stderr, "error: unable to create %s: %s\n", store_dir, strerror(errno));
+        return -1;
+      }
+      snprintf(store_buf, sizeof(store_buf), "%s/%s", store_dir, tn->name);
+      store_dir = store_buf;
+    }
+    if (model_path)
+    {
+      snprintf(model_buf, sizeof(model_buf), "%s.%s", model_path, tn->name);
+      model_path = model_buf;
+    }
+  }
+
+  len = feature_len();
+
+  // retrain = 1 moves the saved model along with only the windows it
+  // hasn't seen, instead of training from scratch
+  if (cfg->retrain && model_path)
+  {
+    if (model_load(&model, model_path) == 0)
+    {
+      if (model.layout != feature_layout() || model.metric != distance_metric
+          || model.proj.in_len != len)
+      {
+        fprintf(stderr, "error: %s was trained with other binning or metric\n", model_path);
+        return -1;
+      }
+      warm = 1;
+      out_printf("Retraining %s, trained up to %ld\n", model_path, model.trained_until);
+    }
+    else
+      out_printf("No model in %s yet, training from scratch\n", model_path);
+  }
+
+  // keep this capture's windows, and train on the stored history if asked
+  if (store_dir)
+  {
+    if (store_open(&store, store_dir, len, feature_layout()) != 0)
+      return -1;
+
+    for (i = 0; i < windows->n; i++)
+      if (store_append(&store, windows->start[i], windows->vecs[i]) != 0)
+        return -1;
+
+    if (warm)
+    {
+      if (store_query(&store, model.trained_until + 1, LONG_MAX, &history) < 0)
+        return -1;
+      train = &history;
+    }
+    else if (cfg->train_secs)
+    {
+      last = store_last(&store);
+      if (store_query(&store, last - cfg->train_secs, last, &history) < 0)
+        return -1;
+      train = &history;
+      out_printf("Training on %d stored windows from the last %ds\n", history.n, cfg->train_secs);
+    }
+
+    store_close(&store);
+  }
+  else if (warm)
+  {
+    // no store, the new windows are the ones in this capture past the model
+    for (i = 0; i < windows->n; i++)
+      if (windows->start[i] > model.trained_until)
+        memcpy(window_set_add(&history, windows->start[i]), windows->vecs[i], len*sizeof(int));
+    train = &history;
+  }
+
+  out_printf("Mapping to metric space..\n");
+  // emd runs over each feature's bins separately, along the ordered ones
+  emd_nsegs = feature_bounds(emd_bounds, &emd_ordered);
+
+  if (warm)
+  {
+    // the centroids only mean something in the space they were made in
+    proj_free(&proj);
+    proj = model.proj;
+    memset(&model.proj, 0, sizeof(model.proj));
+  }
+  else
+  {
+    if (proj.mode == PROJ_PCA && train->n < 2)
+    {
+      out_printf("only %d window, not enough to learn a basis, using raw counts\n", train->n);
+      proj.mode = PROJ_NONE;
+    }
+
+    if (proj.mode == PROJ_PCA)
+      proj_pca(&proj, train->vecs, train->n, len, proj.out_len, 1);
+    else if (proj.mode == PROJ_RANDOM)
+      proj_random(&proj, len, proj.out_len, 1);
+    else
+      proj_none(&proj, len);
+  }
+
+  matrix_alloc_in(&mapped, windows->n, proj.out_len, &run);
+  for (i = 0; i < windows->n; i++)
+    proj_apply(&proj, windows->vecs[i], matrix_row(&mapped, i));
+
+  if (train != windows)
+  {
+    matrix_alloc_in(&trained, train->n, proj.out_len, &run);
+    for (i = 0; i < train->n; i++)
+      proj_apply(&proj, train->vecs[i], matrix_row(&trained, i));
+    tm = &trained;
+  }
+
+  out_printf("%d windows, %d -> %d dimensions\n", windows->n, len, proj.out_len);
+
+  out_printf("Clustering with %s distance..\n", dist_name(distance_metric));
+  if (warm)
+  {
+    out_printf("%d new windows\n", tm->rows);
+    k = model.centroids.rows;
+    matrix_alloc_in(&centroids, k, model.centroids.cols, &run);
+    memcpy(centroids.data, model.centroids.data, (size_t)k*centroids.stride*sizeof(float));
+    map = kmeans_warm(tm, &centroids, model.weights, &run);
+  }
+  else
+  {
+    k = cfg->num_clusters < tm->rows ? cfg->num_clusters : tm->rows;
+    matrix_alloc_in(&centroids, k, proj.out_len, &run);
+    map = kmeans(tm, k, &centroids, &run);
+  }
+
+  sizes = arena_zalloc(&run, k*sizeof(int));
+  for (i = 0; map && i < tm->rows; i++)
+    sizes[map[i]]++;
+  for (c = 0; c < k; c++)
+    out_printf("cluster: %d\t windows: %d\n", c, sizes[c]);
+
+  // the model file keeps the result for the next retrain run
+  if (model_path && k > 0)
+  {
+    if (!warm)
+    {
+      if ((model.weights = malloc(k*sizeof(double))) == NULL)
+      {
+        fprintf(stderr, "error: out of memory for the model's weights\n");
+        return -1;
+      }
+      for (c = 0; c < k; c++)
+        model.weights[c] = sizes[c];
+      model.trained_until = LONG_MIN;
+    }
+
+    for (i = 0; i < train->n; i++)
+      if (train->start[i] > model.trained_until)
+        model.trained_until = train->start[i];
+
+    model.layout = feature_layout();
+    model.metric = distance_metric;
+    model.proj = proj;
+    matrix_free(&model.centroids);
+    model.centroids = centroids;
+    if (model_save(&model, model_path) != 0)
+      return -1;
+
+    // still owned by proj and the run arena
+    memset(&model.proj, 0, sizeof(model.proj));
+    memset(&model.centroids, 0, sizeof(model.centroids));
+  }
+  model_free(&model);
+
+  out_printf("Classifying..\n");
+  for (i = 0; i < windows->n; i++)
+  {
+    c = classify(matrix_row(&mapped, i), &centroids, &dist);
+    out_printf("window: %ld\t cluster: %d\t distance: %f\n", windows->start[i], c, dist);
+  }
+
+  window_set_free(&history);
+  proj_free(&proj);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct hist *h = &hist_total;
+  struct detect_cfg cfg;
+  const char *proj_spec;
+  int i;
+
+  if (out_start(stdout) != 0)
+    return EXIT_FAILURE;
+
+  // every setting, from -C file, HBTAD_* and the command line, see config.h
+  if ((i = config_args(&capture, argc, argv)) != 0)
+  {
+    out_stop();
+    return i > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  out_keep_alerts(capture.deterministic);
+
+  if (!capture.xdp && !capture.nfiles == !capture.dev)
+  {
+    fprintf(stderr, "error: need either a file or an interface (-i)\n\n");
+    print_app_usage();
+    out_stop();
+    return EXIT_FAILURE;
+  }
+
+  // stats dump every stats_interval seconds, query on stats_sock
+  if (stats_start(capture.stats_sock, capture.stats_interval) != 0)
+    return EXIT_FAILURE;
+
+  // e.g. size_bins = log:32, see bins.h
+  if (capture.size_bins && bins_parse(&size_bins, capture.size_bins, 65536, SNAP_LEN) != 0)
+    return EXIT_FAILURE;
+  if (capture.port_bins && bins_parse(&port_bins, capture.port_bins, 1024, 1024) != 0)
+    return EXIT_FAILURE;
+
+  // addr_prefixes = file buckets addresses by prefix group, see addr.h
+  if (capture.addr_prefixes && addr_bins_load(capture.addr_prefixes) != 0)
+    return EXIT_FAILURE;
+
+  // metric = euclid, ned, chi2, hellinger, js or emd, see distance.h
+#ifdef HBTAD_METRIC
+  if (capture.metric)
+    fprintf(stderr, "warning: metric fixed at build time, ignoring metric = %s\n", capture.metric);
+#else
+  if (capture.metric && (distance_metric = dist_parse(capture.metric)) < 0)
+    return EXIT_FAILURE;
+#endif
+
+  // project = pca:N, random:N or none, see proj.h, the histogram metrics
+  // want the raw counts so they default to none
+  proj_spec = capture.project;
+  if (!proj_spec)
+    proj_spec = dist_needs_counts(distance_metric) ? "none" : "pca";
+  if (proj_parse(&cfg.proj, proj_spec) != 0)
+    return EXIT_FAILURE;
+
+  if (dist_needs_counts(distance_metric) && cfg.proj.mode != PROJ_NONE)
+  {
+    fprintf(stderr, "error: metric %s needs project = none\n", dist_name(distance_metric));
+    return EXIT_FAILURE;
+  }
+
+  window_secs = capture.window;
+
+  if (capture.train && !capture.store)
+  {
+    fprintf(stderr, "error: train needs a store\n");
+    return EXIT_FAILURE;
+  }
+
+  // tenants = file splits the traffic by prefix, see tenant.h
+  if (capture.tenants && tenants_load(capture.tenants) != 0)
+    return EXIT_FAILURE;
+
+  cfg.num_clusters = capture.clusters;
+  cfg.store_dir = capture.store;
+  cfg.train_secs = capture.train;
+  cfg.model_path = capture.model;
+  cfg.retrain = capture.retrain;
+
+  // xdp = dev counts live traffic in the kernel, see xdp.h
+  if (capture.xdp && num_tenants > 1)
+  {
+    fprintf(stderr, "error: xdp doesn't split tenants yet\n");
+    return EXIT_FAILURE;
+  }
+
+  out_printf("Loading data..\n");
+  if (capture.xdp)
+  {
+    if (xdp_live(capture.xdp, capture.xdp_obj, capture.xdp_mode) != 0)
+      return EXIT_FAILURE;
+  }
+  else if (capture.dev)
+    live(capture.dev);
+  else if (load(capture.files, capture.nfiles) != 0)
+    return EXIT_FAILURE;
+  window_flush();
+  //printf("Extracting features..\n");
+  for (i = 0; i < addr_bins.nbins; i++)
+  {
+    if (addr_bins.names)
+      out_printf("saddr: %s\t count: %d\n", addr_bins.names[i], h->src_ip_addrs[i]);
+    else
+      out_printf("saddr: %d\t count: %d\n", i, h->src_ip_addrs[i]);
+  }
+
+  for (i = 0; i < addr_bins.nbins; i++)
+  {
+    if (addr_bins.names)
+      out_printf("daddr: %s\t count: %d\n", addr_bins.names[i], h->dst_ip_addrs[i]);
+    else
+      out_printf("daddr: %d\t count: %d\n", i, h->dst_ip_addrs[i]);
+  }
+
+  for (i = 0; i < port_bins.nbins; i++)
+  {
+    out_printf("sport: %u\t count: %d\n", bin_lower(&port_bins, i), h->src_ports[i]);
+  }
+
+  for (i = 0; i < port_bins.nbins; i++)
+  {
+    out_printf("dport: %u\t count: %d\n", bin_lower(&port_bins, i), h->dst_ports[i]);
+  }
+
+  for (i = 0; i < 4; i++)
+  {
+    out_printf("protocol: %d\t count: %d\n", i, h->protocols[i]);
+  }
+
+  for (i = 0; i < size_bins.nbins; i++)
+  {
+    out_printf("packet size: %u\t count: %d\n", bin_lower(&size_bins, i), h->packet_sizes[i]);
+  }
+
+  for (i = 0; i < num_tenants; i++)
+    if (detect(&tenants[i], &cfg) != 0)
+      return EXIT_FAILURE;
+  arena_free(&run);
+
+  out_printf("Finished.\n");
+  out_stop();
+
+  stats_stop();
+  if (capture.stats_sock || capture.stats_interval)
+    stats_dump(stderr);
+
+  return 0;
+}
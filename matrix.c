@@ -0,0 +1,140 @@
+/*
+ * Aligned matrix storage, see matrix.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matrix.h"
+#include "simd.h"
+
+// set up the shape, the bytes to allocate
+static size_t matrix_shape(struct matrix *m, int rows, int cols)
+{
+    m->rows = rows;
+    m->cols = cols;
+    m->stride = (cols + MATRIX_ALIGN - 1)/MATRIX_ALIGN*MATRIX_ALIGN;
+
+    // aligned_alloc wants a multiple of the alignment, and at least that
+    return (size_t)(rows > 0 ? rows : 1)*(m->stride > 0 ? m->stride : MATRIX_ALIGN)*sizeof(float);
+}
+
+void matrix_alloc(struct matrix *m, int rows, int cols)
+{
+    size_t bytes = matrix_shape(m, rows, cols);
+
+    if ((m->data = aligned_alloc(64, bytes)) == NULL)
+    {
+        fprintf(stderr, "ERROR! matrix: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(m->data, 0, bytes);
+}
+
+void matrix_free(struct matrix *m)
+{
+    free(m->data);
+    m->data = NULL;
+    m->rows = m->cols = m->stride = 0;
+}
+
+void matrix_alloc_in(struct matrix *m, int rows, int cols, struct arena *a)
+{
+    m->data = arena_zalloc(a, matrix_shape(m, rows, cols));
+}
+
+void matrix_transpose(struct matrix *t, const struct matrix *m, struct arena *a)
+{
+    int i, j;
+
+    matrix_alloc_in(t, m->cols, m->rows, a);
+    for (i = 0; i < m->rows; i++)
+        for (j = 0; j < m->cols; j++)
+            matrix_row(t, j)[i] = matrix_row(m, i)[j];
+}
+
+/*
+ * Blocked, register tiled multiply.
+ *
+ * The micro kernel keeps a GEMM_MR x (2 vectors) tile of out in registers
+ * and runs down the shared dimension, one broadcast of a and two loads of
+ * bt per GEMM_MR*2 multiply-adds.  The shared dimension is cut into blocks
+ * of GEMM_KC so the slice of bt being swept stays in L1/L2 while every
+ * row tile of a passes over it.  bt columns are padded to a multiple of
+ * MATRIX_ALIGN with zeros, so column tiles never need an edge case; row
+ * tiles at the end repeat the last row and drop the extra results.
+ */
+#define GEMM_MR 6
+#define GEMM_KC 256
+
+#define GEMM_ROW(r) \
+    x = vf_set1(ap##r[k]); \
+    acc##r##0 = vf_fma(x, b0, acc##r##0); \
+    acc##r##1 = vf_fma(x, b1, acc##r##1);
+
+#define GEMM_LOAD(r) \
+    if (k0 > 0 && r < m) \
+    { \
+        acc##r##0 = vf_loada(out + r*ldo + j); \
+        acc##r##1 = vf_loada(out + r*ldo + j + VF_W); \
+    } \
+    else \
+        acc##r##0 = acc##r##1 = vf_zero();
+
+#define GEMM_STORE(r) \
+    if (r < m) \
+    { \
+        vf_storea(out + r*ldo + j, acc##r##0); \
+        vf_storea(out + r*ldo + j + VF_W, acc##r##1); \
+    }
+
+static void gemm_tile(const float **ap, int m, const struct matrix *bt, int k0, int k1, float *out, int ldo)
+{
+    const float *ap0 = ap[0], *ap1 = ap[1], *ap2 = ap[2];
+    const float *ap3 = ap[3], *ap4 = ap[4], *ap5 = ap[5];
+    const float *bp;
+    vf acc00, acc01, acc10, acc11, acc20, acc21;
+    vf acc30, acc31, acc40, acc41, acc50, acc51;
+    vf x, b0, b1;
+    int j, k;
+
+    for (j = 0; j < bt->stride; j += 2*VF_W)
+    {
+        GEMM_LOAD(0) GEMM_LOAD(1) GEMM_LOAD(2)
+        GEMM_LOAD(3) GEMM_LOAD(4) GEMM_LOAD(5)
+
+        bp = bt->data + (size_t)k0*bt->stride + j;
+        for (k = k0; k < k1; k++, bp += bt->stride)
+        {
+            b0 = vf_loada(bp);
+            b1 = vf_loada(bp + VF_W);
+            GEMM_ROW(0) GEMM_ROW(1) GEMM_ROW(2)
+            GEMM_ROW(3) GEMM_ROW(4) GEMM_ROW(5)
+        }
+
+        GEMM_STORE(0) GEMM_STORE(1) GEMM_STORE(2)
+        GEMM_STORE(3) GEMM_STORE(4) GEMM_STORE(5)
+    }
+}
+
+void matrix_mul(const struct matrix *a, int lo, int hi, const struct matrix *bt, float *out)
+{
+    const float *ap[GEMM_MR];
+    int i, r, m, k0, k1;
+
+    for (k0 = 0; k0 < a->cols; k0 += GEMM_KC)
+    {
+        k1 = k0 + GEMM_KC < a->cols ? k0 + GEMM_KC : a->cols;
+
+        for (i = lo; i < hi; i += GEMM_MR)
+        {
+            m = hi - i < GEMM_MR ? hi - i : GEMM_MR;
+            for (r = 0; r < GEMM_MR; r++)
+                ap[r] = matrix_row(a, r < m ? i + r : i + m - 1);
+
+            gemm_tile(ap, m, bt, k0, k1, out + (size_t)(i - lo)*bt->stride, bt->stride);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+/*
+ * Dense float matrices for the clustering code.
+ *
+ * One allocation, rows padded to a multiple of 64 bytes and the whole
+ * block 64 byte aligned, so every row starts on a cache line and the
+ * vector kernels never split a load across two lines.  The padding is
+ * zeroed.  A matrix from an arena goes with the arena, matrix_free() is
+ * only for the others.
+ */
+
+#include <stddef.h>
+
+#include "arena.h"
+
+// row stride is a multiple of this many floats
+#define MATRIX_ALIGN 16
+
+struct matrix {
+    float *data;
+    int rows;
+    int cols;
+    int stride;     // floats from one row to the next
+};
+
+// zeroed rows x cols matrix, exits when out of memory
+void matrix_alloc(struct matrix *m, int rows, int cols);
+void matrix_free(struct matrix *m);
+
+// the same in arena a
+void matrix_alloc_in(struct matrix *m, int rows, int cols, struct arena *a);
+
+// t = m transposed, t is allocated here in arena a
+void matrix_transpose(struct matrix *t, const struct matrix *m, struct arena *a);
+
+// out = rows lo .. hi-1 of a times bt, where bt is the transpose of the
+// matrix whose rows are dotted with those of a (bt->rows == a->cols).
+// out holds hi - lo rows of bt->stride floats, the padding columns end up 0
+void matrix_mul(const struct matrix *a, int lo, int hi, const struct matrix *bt, float *out);
+
+static inline float *matrix_row(const struct matrix *m, int r)
+{
+    return m->data + (size_t)r*m->stride;
+}
+
+#endif
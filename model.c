@@ -0,0 +1,108 @@
+/*
+ * Saved models, see model.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "model.h"
+
+struct model_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t layout;
+    int32_t metric;
+    int32_t k;
+    int64_t trained_until;
+};
+
+int model_load(struct model *m, const char *path)
+{
+    struct model_header h;
+    FILE *fp;
+    int i;
+
+    memset(m, 0, sizeof(*m));
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return -1;
+
+    if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != MODEL_MAGIC
+        || h.version != MODEL_VERSION || h.k < 1)
+    {
+        fprintf(stderr, "ERROR! model: %s is not a model file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    m->layout = h.layout;
+    m->metric = h.metric;
+    m->trained_until = h.trained_until;
+
+    if (proj_read(&m->proj, fp) != 0)
+        goto bad;
+
+    matrix_alloc(&m->centroids, h.k, m->proj.out_len);
+    for (i = 0; i < h.k; i++)
+        if (fread(matrix_row(&m->centroids, i), sizeof(float), m->centroids.cols, fp)
+            != (size_t)m->centroids.cols)
+            goto bad;
+
+    if ((m->weights = malloc(h.k*sizeof(double))) == NULL
+        || fread(m->weights, sizeof(double), h.k, fp) != (size_t)h.k)
+        goto bad;
+
+    fclose(fp);
+    return 0;
+
+bad:
+    fprintf(stderr, "ERROR! model: %s is truncated or damaged\n", path);
+    fclose(fp);
+    model_free(m);
+    return -1;
+}
+
+int model_save(const struct model *m, const char *path)
+{
+    struct model_header h = {
+        MODEL_MAGIC, MODEL_VERSION, m->layout, m->metric, m->centroids.rows, m->trained_until
+    };
+    char tmp[4096];
+    FILE *fp;
+    int i, err = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "wb")) == NULL)
+    {
+        fprintf(stderr, "ERROR! model: unable to write %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    err |= fwrite(&h, sizeof(h), 1, fp) != 1;
+    err |= proj_write(&m->proj, fp) != 0;
+    for (i = 0; i < m->centroids.rows; i++)
+        err |= fwrite(matrix_row(&m->centroids, i), sizeof(float), m->centroids.cols, fp)
+               != (size_t)m->centroids.cols;
+    err |= fwrite(m->weights, sizeof(double), m->centroids.rows, fp) != (size_t)m->centroids.rows;
+    err |= fclose(fp) != 0;
+
+    // readers see the old model or the new one, never half of one
+    if (err || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "ERROR! model: unable to write %s: %s\n", path, strerror(errno));
+        remove(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void model_free(struct model *m)
+{
+    proj_free(&m->proj);
+    matrix_free(&m->centroids);
+    free(m->weights);
+    m->weights = NULL;
+}
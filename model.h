@@ -0,0 +1,36 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+/*
+ * A trained detector saved to disk: the metric space mapping, the
+ * centroids, how many windows each centroid stands for, and the start of
+ * the newest window it has seen.  Retraining loads it, feeds kmeans_warm()
+ * the windows after trained_until and saves it back.
+ */
+
+#include <stdint.h>
+
+#include "proj.h"
+#include "matrix.h"
+
+#define MODEL_MAGIC 0x4d544248     // "HBTM"
+#define MODEL_VERSION 1
+
+struct model {
+    uint64_t layout;        // feature_layout() of the windows
+    int metric;
+    long trained_until;
+    struct projection proj;
+    struct matrix centroids;
+    double *weights;        // one per centroid
+};
+
+// 0 on success, -1 if missing or unreadable
+int model_load(struct model *m, const char *path);
+
+// written to path.tmp first and renamed over path
+int model_save(const struct model *m, const char *path);
+
+void model_free(struct model *m);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Asynchronous report/alert writer.
+ *
+ * The packet path and main() only format into a single-producer/
+ * single-consumer ring; a dedicated thread does the actual stdio writes,
+ * so capture and feature extraction never block on stdout or disk I/O.
+ * The producer is whichever thread calls out_printf()/out_alert(), there
+ * must only ever be one at a time.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "output.h"
+
+#define OUT_MASK (OUT_RING_SIZE - 1)
+
+struct out_msg {
+    int len;
+    char buf[OUT_MSG_LEN];
+};
+
+struct out_ring {
+    // head is only written by the producer, tail only by the writer
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) struct out_msg msgs[OUT_RING_SIZE];
+};
+
+static struct out_ring ring;
+static pthread_t writer;
+static FILE *out_fp;
+static atomic_int running;
+static int started;
+static unsigned long dropped;
+static int keep_alerts;
+
+static void *writer_loop(void *arg)
+{
+    unsigned int head, tail;
+    struct out_msg *msg;
+
+    (void)arg;
+
+    for (;;)
+    {
+        tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+        head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            fflush(out_fp);
+
+            if (!atomic_load_explicit(&running, memory_order_acquire)
+                && atomic_load_explicit(&ring.head, memory_order_acquire) == tail)
+                break;
+
+            usleep(1000);
+            continue;
+        }
+
+        // write out everything that is ready before publishing the new tail
+        while (tail != head)
+        {
+            msg = &ring.msgs[tail & OUT_MASK];
+            fwrite(msg->buf, 1, msg->len, out_fp);
+            tail++;
+        }
+
+        atomic_store_explicit(&ring.tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+int out_start(FILE *fp)
+{
+    if (started)
+        return 0;
+
+    out_fp = fp;
+    atomic_store(&running, 1);
+
+    if (pthread_create(&writer, NULL, writer_loop, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR! out_start: unable to create writer thread\n");
+        return -1;
+    }
+
+    started = 1;
+    atexit(out_stop);
+
+    return 0;
+}
+
+void out_stop(void)
+{
+    if (!started)
+        return;
+
+    started = 0;
+    atomic_store_explicit(&running, 0, memory_order_release);
+    pthread_join(writer, NULL);
+
+    if (dropped > 0)
+        fprintf(stderr, "WARNING! %lu alerts dropped, output ring full\n", dropped);
+
+    fflush(out_fp);
+}
+
+// returns 0 if the line was queued, -1 if the ring is full and we can't wait
+static int out_vqueue(int wait, const char *fmt, va_list ap)
+{
+    unsigned int head, tail;
+    struct out_msg *msg;
+    int len;
+
+    // writer not running, just write it directly
+    if (!started)
+    {
+        vprintf(fmt, ap);
+        return 0;
+    }
+
+    head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+
+    for (;;)
+    {
+        tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+
+        if (head - tail < OUT_RING_SIZE)
+            break;
+
+        if (!wait)
+        {
+            dropped++;
+            return -1;
+        }
+
+        sched_yield();
+    }
+
+    msg = &ring.msgs[head & OUT_MASK];
+    len = vsnprintf(msg->buf, OUT_MSG_LEN, fmt, ap);
+
+    if (len < 0)
+        len = 0;
+    else if (len >= OUT_MSG_LEN)
+        len = OUT_MSG_LEN - 1;
+
+    msg->len = len;
+    atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+
+    return 0;
+}
+
+void out_printf(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    out_vqueue(1, fmt, ap);
+    va_end(ap);
+}
+
+void out_alert(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    out_vqueue(keep_alerts, fmt, ap);
+    va_end(ap);
+}
+
+void out_keep_alerts(int keep)
+{
+    keep_alerts = keep;
+}
@@ -0,0 +1,27 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+// size of a single queued line, longer lines are truncated
+#define OUT_MSG_LEN 256
+
+// number of slots in the ring, must be a power of 2
+#define OUT_RING_SIZE 8192
+
+// start the writer thread, all queued output is written to fp
+int out_start(FILE *fp);
+
+// drain the ring, join the writer thread and report dropped alerts
+void out_stop(void);
+
+// queue a report line, waits for a free slot if the ring is full
+void out_printf(const char *fmt, ...);
+
+// queue an alert from the packet path, dropped if the ring is full
+void out_alert(const char *fmt, ...);
+
+// make alerts wait for a free slot too, so none are ever dropped
+void out_keep_alerts(int keep);
+
+#endif
@@ -0,0 +1,431 @@
+/*
+ * Native pcapng reader, see pcapng.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hbtad.h"
+#include "pcapng.h"
+
+#define BT_SHB 0x0A0D0D0A
+#define BT_IDB 1
+#define BT_PB 2             // obsolete packet block
+#define BT_SPB 3
+#define BT_EPB 6
+
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+// how far the walk gets before the file's size is looked at again
+#define RECHECK_BYTES (4 << 20)
+
+#define OPT_END 0
+#define OPT_IF_TSRESOL 9
+#define OPT_IF_TSOFFSET 14
+
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+#ifndef DLT_IPV4
+#define DLT_IPV4 228
+#endif
+
+// how to get from the start of a frame to its IP header, past an ethernet
+// frame's VLAN tag too, see ether_l3_off()
+static const struct link {
+    int linktype;
+    int dlt;            // for compiling the filter
+    int l3_off;
+} links[] = {
+    { 1, DLT_EN10MB, 14 },          // ethernet
+    { 101, DLT_RAW, 0 },            // raw ip
+    { 228, DLT_IPV4, 0 },
+    { 113, DLT_LINUX_SLL, 16 },     // linux cooked
+    { 276, DLT_LINUX_SLL2, 20 },
+    { 0, DLT_NULL, 4 },             // bsd loopback, 4 byte family
+    { 108, DLT_LOOP, 4 },
+};
+
+const char *link_filter(int dlt)
+{
+    // "vlan" only compiles for ethernet
+    return dlt == DLT_EN10MB ? "ip or (vlan and ip)" : "ip";
+}
+
+int link_l3_off(int dlt)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(links)/sizeof(links[0]); i++)
+        if (links[i].dlt == dlt)
+            return links[i].l3_off;
+
+    return -1;
+}
+
+struct iface {
+    const struct link *link;        // NULL if unsupported
+    uint64_t units;                 // timestamp units per second
+    int64_t offset;                 // seconds added to every timestamp
+    uint32_t snaplen;
+    struct bpf_program fp;
+    int warned;
+};
+
+struct pcapng {
+    const u_char *map;
+    size_t map_size;
+    size_t size;                    // of the file at the last look, at most map_size
+    size_t checked;                 // blocks up to here were in the file then
+    int fd;
+    size_t off;                     // next block
+    int swap;
+    struct iface *ifaces;
+    int nifaces;
+    int cap;
+    const char *path;
+    const char *filter;
+    struct timeval last_ts;         // of the last timestamped packet, for SPBs
+};
+
+static uint16_t rd16(const struct pcapng *r, const u_char *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const struct pcapng *r, const u_char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint64_t rd64(const struct pcapng *r, const u_char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swap ? __builtin_bswap64(v) : v;
+}
+
+int pcapng_is(const char *path)
+{
+    uint32_t magic = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return 0;
+    if (fread(&magic, sizeof(magic), 1, fp) != 1)
+        magic = 0;
+    fclose(fp);
+
+    // the same either way round
+    return magic == BT_SHB;
+}
+
+static void free_ifaces(struct pcapng *r)
+{
+    int i;
+
+    for (i = 0; i < r->nifaces; i++)
+        if (r->ifaces[i].link)
+            pcap_freecode(&r->ifaces[i].fp);
+    r->nifaces = 0;
+}
+
+static int add_iface(struct pcapng *r, const u_char *body, uint32_t len)
+{
+    struct iface *f;
+    const u_char *opt, *end = body + len;
+    uint16_t code, olen;
+    unsigned int i, res;
+    const char *filter;
+    pcap_t *dead;
+
+    if (len < 8)
+    {
+        fprintf(stderr, "ERROR! pcapng: %s: short interface block\n", r->path);
+        return -1;
+    }
+
+    if (r->nifaces == r->cap)
+    {
+        r->cap = r->cap ? 2*r->cap : 8;
+        if ((r->ifaces = realloc(r->ifaces, r->cap*sizeof(*r->ifaces))) == NULL)
+        {
+            fprintf(stderr, "ERROR! pcapng: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    f = &r->ifaces[r->nifaces];
+    memset(f, 0, sizeof(*f));
+    f->units = 1000000;
+    f->snaplen = rd32(r, body + 4);
+
+    for (i = 0; i < sizeof(links)/sizeof(links[0]); i++)
+        if (links[i].linktype == rd16(r, body))
+            f->link = &links[i];
+
+    for (opt = body + 8; opt + 4 <= end; opt += 4 + ((olen + 3) & ~3))
+    {
+        code = rd16(r, opt);
+        olen = rd16(r, opt + 2);
+        if (code == OPT_END || opt + 4 + olen > end)
+            break;
+
+        if (code == OPT_IF_TSRESOL && olen >= 1)
+        {
+            // 10^-n, or 2^-n with the top bit set
+            res = opt[4];
+            if (res & 0x80)
+                f->units = 1ULL << ((res & 0x7f) < 63 ? res & 0x7f : 63);
+            else
+                for (f->units = 1; res > 0 && f->units <= UINT64_MAX/10; res--)
+                    f->units *= 10;
+        }
+        else if (code == OPT_IF_TSOFFSET && olen >= 8)
+            f->offset = (int64_t)rd64(r, opt + 4);
+    }
+
+    if (f->link)
+    {
+        filter = r->filter ? r->filter : link_filter(f->link->dlt);
+        dead = pcap_open_dead(f->link->dlt, 262144);
+        if (!dead || pcap_compile(dead, &f->fp, filter, 1, PCAP_NETMASK_UNKNOWN) == -1)
+        {
+            fprintf(stderr, "ERROR! pcapng: couldn't parse filter %s: %s\n", filter,
+                    dead ? pcap_geterr(dead) : "out of memory");
+            if (dead)
+                pcap_close(dead);
+            return -1;
+        }
+        pcap_close(dead);
+    }
+
+    r->nifaces++;
+
+    return 0;
+}
+
+// fill in h from a timestamp in the interface's units
+static void set_ts(const struct iface *f, uint64_t ts, struct pcap_pkthdr *h)
+{
+    uint64_t frac = ts % f->units;
+
+    h->ts.tv_sec = ts/f->units + f->offset;
+    h->ts.tv_usec = f->units == 1000000 ? frac
+        : (suseconds_t)((long double)frac*1000000/f->units);
+}
+
+struct pcapng *pcapng_open(const char *path, const char *filter)
+{
+    struct pcapng *r;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "ERROR! pcapng: unable to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    if ((r = calloc(1, sizeof(*r))) == NULL)
+    {
+        fprintf(stderr, "ERROR! pcapng: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    r->path = path;
+    r->filter = filter;
+
+    r->size = r->map_size = st.st_size;
+    if (r->size == 0 || (r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR! pcapng: unable to map %s: %s\n", path,
+                r->size ? strerror(errno) : "empty file");
+        close(fd);
+        free(r);
+        return NULL;
+    }
+    r->fd = fd;
+    madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+    return r;
+}
+
+// make sure the file still reaches end before the mapping is read there,
+// pages past the end of a file that was cut short fault with SIGBUS
+static void recheck(struct pcapng *r, size_t end)
+{
+    struct stat st;
+
+    if (end <= r->checked)
+        return;
+
+    if (fstat(r->fd, &st) == 0 && (size_t)st.st_size < r->size)
+    {
+        fprintf(stderr, "warning: %s: cut short to %zu bytes while being read\n",
+                r->path, (size_t)st.st_size);
+        r->size = st.st_size;
+    }
+    r->checked = end + RECHECK_BYTES < r->size ? end + RECHECK_BYTES : r->size;
+}
+
+int pcapng_next(struct pcapng *r, struct pcap_pkthdr *h, const u_char **l3, int *l3_len)
+{
+    struct iface *f;
+    const u_char *p, *body, *data;
+    uint32_t type, len, blen, ifid;
+    size_t off;
+    int l3_off;
+
+    for (; r->off + 12 <= r->size; r->off += len)
+    {
+        off = r->off;
+        recheck(r, off + 12);
+        if (off + 12 > r->size)
+            break;
+        p = r->map + off;
+
+        // a section header fixes the byte order of everything up to the next one
+        if (rd32(r, p) == BT_SHB)
+        {
+            if (memcmp(p + 8, &(uint32_t){ BYTE_ORDER_MAGIC }, 4) == 0)
+                r->swap = 0;
+            else if (memcmp(p + 8, &(uint32_t){ __builtin_bswap32(BYTE_ORDER_MAGIC) }, 4) == 0)
+                r->swap = 1;
+            else
+            {
+                fprintf(stderr, "ERROR! pcapng: %s: bad byte order magic\n", r->path);
+                return -1;
+            }
+            free_ifaces(r);
+        }
+        else if (off == 0)
+        {
+            fprintf(stderr, "ERROR! pcapng: %s doesn't start with a section header\n", r->path);
+            return -1;
+        }
+
+        type = rd32(r, p);
+        len = rd32(r, p + 4);
+        if (len < 12 || len % 4 != 0)
+        {
+            fprintf(stderr, "ERROR! pcapng: %s: bad block length %u at %zu\n", r->path, len, off);
+            return -1;
+        }
+        recheck(r, off + len);
+        if (len > r->size - off)
+        {
+            fprintf(stderr, "warning: %s: last block cut off\n", r->path);
+            r->off = r->size;
+            return 0;
+        }
+
+        body = p + 8;
+        blen = len - 12;
+
+        switch (type)
+        {
+            case BT_IDB:
+                if (add_iface(r, body, blen) != 0)
+                    return -1;
+                continue;
+
+            case BT_EPB:
+            case BT_PB:
+                if (blen < 20)
+                    goto short_block;
+                ifid = type == BT_EPB ? rd32(r, body) : rd16(r, body);
+                h->caplen = rd32(r, body + 12);
+                h->len = rd32(r, body + 16);
+                data = body + 20;
+                if (h->caplen > blen - 20)
+                    goto short_block;
+                if (ifid >= (uint32_t)r->nifaces)
+                    goto no_iface;
+                f = &r->ifaces[ifid];
+                set_ts(f, (uint64_t)rd32(r, body + 4) << 32 | rd32(r, body + 8), h);
+                r->last_ts = h->ts;
+                break;
+
+            case BT_SPB:
+                // interface 0, the length is implied and there is no
+                // timestamp, it goes with the packet before
+                if (blen < 4)
+                    goto short_block;
+                if (r->nifaces == 0)
+                {
+                    ifid = 0;
+                    goto no_iface;
+                }
+                f = &r->ifaces[0];
+                h->len = rd32(r, body);
+                h->caplen = h->len < blen - 4 ? h->len : blen - 4;
+                if (f->snaplen && h->caplen > f->snaplen)
+                    h->caplen = f->snaplen;
+                data = body + 4;
+                h->ts = r->last_ts;
+                break;
+
+            default:
+                continue;
+        }
+
+        if (!f->link)
+        {
+            if (!f->warned)
+                fprintf(stderr, "warning: %s: skipping interface %u, unsupported link type\n",
+                        r->path, (unsigned int)(f - r->ifaces));
+            f->warned = 1;
+            continue;
+        }
+
+        if (h->caplen < (uint32_t)f->link->l3_off || !pcap_offline_filter(&f->fp, h, data))
+            continue;
+
+        // parse_ip() stops at *l3_len, so even the last packet in the mapping
+        // is handed on in place
+        r->off += len;
+        l3_off = f->link->dlt == DLT_EN10MB ? ether_l3_off(data, h->caplen) : f->link->l3_off;
+        *l3 = data + l3_off;
+        *l3_len = h->caplen - l3_off;
+        return 1;
+    }
+
+    return 0;
+
+short_block:
+    fprintf(stderr, "ERROR! pcapng: %s: packet block at %zu too short\n", r->path, off);
+    return -1;
+
+no_iface:
+    fprintf(stderr, "ERROR! pcapng: %s: packet at %zu on undeclared interface %u\n",
+            r->path, off, ifid);
+    return -1;
+}
+
+void pcapng_close(struct pcapng *r)
+{
+    if (!r)
+        return;
+
+    free_ifaces(r);
+    free(r->ifaces);
+    munmap((void *)r->map, r->map_size);
+    close(r->fd);
+    free(r);
+}
@@ -0,0 +1,60 @@
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+/*
+ * Native pcapng reader.
+ *
+ * The file is mapped and walked block by block, packets are handed on as
+ * pointers into the mapping, nothing is copied.  Section headers in either
+ * byte order, any number of Interface Description Blocks per section, and
+ * Enhanced, Simple and the old Packet Blocks are understood, everything
+ * else is skipped.
+ *
+ * Every interface has its own link type, decoded to the IP header by the
+ * link table in pcapng.c (ethernet, raw IP, Linux cooked v1 and v2, BSD
+ * loopback), and its own timestamp resolution (if_tsresol, microseconds
+ * if not given, nanoseconds from most appliances) and offset
+ * (if_tsoffset).  The filter expression is compiled per link type and run
+ * with pcap_offline_filter(), so -f means the same as with libpcap.
+ *
+ * Simple Packet Blocks carry no timestamp, they get the one of the packet
+ * read before them (0 if there is none yet), so they keep the windows and
+ * the merge of several files in order.
+ *
+ * A block cut off at the end of the file, as when the capture is still
+ * being written, ends the read with a warning.  The walk stops at the size
+ * the file had when it was opened, whatever is written after that is left
+ * for the next read.  The mapping is private and the size is looked at
+ * again every few MB, so a file that a rotating writer truncates under
+ * the reader ends early with a warning too, instead of with SIGBUS.  A
+ * truncation between two looks can still fault; keep live captures out
+ * of directories that are being replayed.
+ */
+
+#include <pcap.h>
+
+// is path a pcapng file (starts with a section header)
+int pcapng_is(const char *path);
+
+struct pcapng;
+
+// map path, filter is compiled for each interface as it comes, NULL for
+// link_filter()'s.  NULL on errors
+struct pcapng *pcapng_open(const char *path, const char *filter);
+
+// the next packet that passes the filter, l3 is its IP header and stays
+// valid until the next call, l3_len is what was captured from there on.  1
+// for a packet, 0 at the end, -1 on errors
+int pcapng_next(struct pcapng *r, struct pcap_pkthdr *h, const u_char **l3, int *l3_len);
+
+void pcapng_close(struct pcapng *r);
+
+// bytes from the start of a frame to its IP header for a DLT_ link type in
+// the link table in pcapng.c, for classic pcap files too.  -1 if unsupported.
+// Ethernet frames can have 4 more, see ether_l3_off()
+int link_l3_off(int dlt);
+
+// the filter when none is given: IP packets, on ethernet tagged ones too
+const char *link_filter(int dlt);
+
+#endif
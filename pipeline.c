@@ -0,0 +1,301 @@
+/*
+ * Staged capture pipeline, see pipeline.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "hbtad.h"
+#include "hist.h"
+#include "stats.h"
+#include "tenant.h"
+#include "config.h"
+#include "queue.h"
+#include "affinity.h"
+#include "pipeline.h"
+
+// slots between aggregate and vectorize, a window is a whole hist per tenant
+#define PIPE_WINDOWS 16
+
+struct pipe_pkt {
+    long ts;
+    int len;                        // of l3, at most PIPE_SNAP
+    u_char l3[PIPE_SNAP];
+};
+
+struct pipe_feat {
+    long ts;
+    struct pkt_features pf;
+};
+
+struct pipe_window {
+    long start;
+    struct hist h[];            // num_tenants of them
+};
+
+struct parser {
+    struct queue in;            // from capture
+    struct queue out;           // to aggregate
+    int cpu;
+    pthread_t thread;
+};
+
+static struct parser parsers[PIPE_MAX_PARSERS];
+static int num_parsers;
+static struct queue windows;
+static pthread_t aggregator, vectorizer;
+static int running;
+static int next_parser;         // capture's round robin
+
+// wait a little for a queue, spin first, then yield, then sleep
+static void pipe_idle(int *spins)
+{
+    if (++*spins < 64)
+        __asm__ __volatile__("" ::: "memory");
+    else if (*spins < 128)
+        sched_yield();
+    else
+        usleep(50);
+}
+
+static void *parse_loop(void *arg)
+{
+    struct parser *p = arg;
+    struct pipe_pkt *pkt;
+    struct pipe_feat *f;
+    int spins = 0;
+
+    affinity_pin("parse", p->cpu);
+
+    for (;;)
+    {
+        if ((pkt = queue_peek(&p->in)) == NULL)
+        {
+            if (queue_done(&p->in))
+                break;
+            pipe_idle(&spins);
+            continue;
+        }
+
+        if ((f = queue_slot(&p->out)) == NULL)
+        {
+            queue_full(&p->out, 0);
+            while ((f = queue_slot(&p->out)) == NULL)
+                pipe_idle(&spins);
+        }
+        spins = 0;
+
+        f->ts = pkt->ts;
+        parse_count(pkt->l3, pkt->len, &f->pf);
+
+        queue_pop(&p->in);
+        queue_push(&p->out);
+    }
+
+    queue_close(&p->out);
+    return NULL;
+}
+
+static void *aggregate_loop(void *arg)
+{
+    struct pipe_feat *f;
+    int i = 0, spins = 0;
+    STAT_TIMER(t);
+
+    (void)arg;
+    affinity_pin("aggregate", capture.cpu_aggregate);
+
+    // the same round robin as the capture, so in capture order
+    for (;;)
+    {
+        if ((f = queue_peek(&parsers[i].out)) == NULL)
+        {
+            if (queue_done(&parsers[i].out))
+                break;
+            pipe_idle(&spins);
+            continue;
+        }
+        spins = 0;
+
+        window_tick(f->ts);
+
+        STAT_START(t);
+        hist_add(&f->pf);
+        STAT_LAP(t, STAGE_HIST);
+
+        queue_pop(&parsers[i].out);
+        i = i + 1 == num_parsers ? 0 : i + 1;
+    }
+
+    queue_close(&windows);
+    return NULL;
+}
+
+static void *vectorize_loop(void *arg)
+{
+    struct pipe_window *w;
+    int spins = 0;
+
+    (void)arg;
+    affinity_pin("vectorize", capture.cpu_vectorize);
+
+    for (;;)
+    {
+        if ((w = queue_peek(&windows)) == NULL)
+        {
+            if (queue_done(&windows))
+                break;
+            pipe_idle(&spins);
+            continue;
+        }
+        spins = 0;
+
+        window_keep(w->start, w->h);
+        queue_pop(&windows);
+    }
+
+    return NULL;
+}
+
+int pipeline_window(long start, const struct hist *h)
+{
+    struct pipe_window *w;
+    int spins = 0;
+
+    if (!running)
+        return -1;
+
+    if ((w = queue_slot(&windows)) == NULL)
+    {
+        queue_full(&windows, 0);
+        while ((w = queue_slot(&windows)) == NULL)
+            pipe_idle(&spins);
+    }
+
+    w->start = start;
+    memcpy(w->h, h, num_tenants*sizeof(*h));
+    queue_push(&windows);
+
+    return 0;
+}
+
+void pipeline_ip(const struct pcap_pkthdr *h, const u_char *l3, int len)
+{
+    struct queue *q = &parsers[next_parser].in;
+    struct pipe_pkt *pkt;
+    int spins = 0;
+
+    if ((pkt = queue_slot(q)) == NULL)
+    {
+        queue_full(q, capture.drop);
+        if (capture.drop)
+        {
+            STAT_INC(STAT_DROPPED);
+            return;
+        }
+        while ((pkt = queue_slot(q)) == NULL)
+            pipe_idle(&spins);
+    }
+
+    // headers only, parse_ip() doesn't read any further
+    pkt->ts = h->ts.tv_sec;
+    pkt->len = len < PIPE_SNAP ? len : PIPE_SNAP;
+    if (pkt->len > 0)
+        memcpy(pkt->l3, l3, pkt->len);
+
+    queue_push(q);
+    next_parser = next_parser + 1 == num_parsers ? 0 : next_parser + 1;
+}
+
+void pipeline_packet(u_char *args, const struct pcap_pkthdr *h, const u_char *packet)
+{
+    int off = ether_l3_off(packet, (int)h->caplen);
+
+    pipeline_ip(h, packet + off, (int)h->caplen - off);
+}
+
+// the queues of pipeline_start(), queue_free() takes ones never set up too
+static void pipe_free(void)
+{
+    int i;
+
+    for (i = 0; i < num_parsers; i++)
+    {
+        queue_free(&parsers[i].in);
+        queue_free(&parsers[i].out);
+    }
+    queue_free(&windows);
+}
+
+int pipeline_start(void)
+{
+    char name[32];
+    int i, node;
+
+    num_parsers = capture.parsers;
+    next_parser = 0;
+
+    // each queue on the node of the parser between its two ends
+    for (i = 0; i < num_parsers; i++)
+    {
+        parsers[i].cpu = capture.cpu_parse < 0 ? -1 : capture.cpu_parse + i;
+        node = parsers[i].cpu < 0 ? -1 : affinity_node(parsers[i].cpu);
+        snprintf(name, sizeof(name), "parse%d_in", i);
+        if (queue_init(&parsers[i].in, name, capture.queue_len, sizeof(struct pipe_pkt), node) != 0)
+            goto fail;
+        snprintf(name, sizeof(name), "parse%d_out", i);
+        if (queue_init(&parsers[i].out, name, capture.queue_len, sizeof(struct pipe_feat), node) != 0)
+            goto fail;
+    }
+    node = capture.cpu_vectorize < 0 ? -1 : affinity_node(capture.cpu_vectorize);
+    if (queue_init(&windows, "windows", PIPE_WINDOWS,
+                   sizeof(struct pipe_window) + num_tenants*sizeof(struct hist), node) != 0)
+        goto fail;
+
+    running = 1;
+
+    for (i = 0; i < num_parsers; i++)
+        if (pthread_create(&parsers[i].thread, NULL, parse_loop, &parsers[i]) != 0)
+            break;
+    if (i < num_parsers || pthread_create(&aggregator, NULL, aggregate_loop, NULL) != 0
+        || pthread_create(&vectorizer, NULL, vectorize_loop, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR! pipeline: unable to create stage threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+
+fail:
+    pipe_free();
+    return -1;
+}
+
+void pipeline_stop(void)
+{
+    uint64_t dropped = 0;
+    int i;
+
+    if (!running)
+        return;
+
+    for (i = 0; i < num_parsers; i++)
+        queue_close(&parsers[i].in);
+    for (i = 0; i < num_parsers; i++)
+        pthread_join(parsers[i].thread, NULL);
+    pthread_join(aggregator, NULL);
+    pthread_join(vectorizer, NULL);
+    running = 0;
+
+    for (i = 0; i < num_parsers; i++)
+        dropped += parsers[i].in.dropped;
+    pipe_free();
+
+    if (dropped > 0)
+        fprintf(stderr, "WARNING! %llu packets dropped, parse queues full\n",
+                (unsigned long long)dropped);
+}
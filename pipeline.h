@@ -0,0 +1,65 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*
+ * Staged capture: capture -> parse -> aggregate -> vectorize.
+ *
+ * With pipeline = 1 (-P) the capture thread does no more than copy the
+ * first PIPE_SNAP bytes of each packet's IP header into a queue slot.
+ * Everything else runs on threads of its own, joined by bounded SPSC
+ * queues (queue.h):
+ *
+ *   capture    the reader or live capture, hands packets round robin to
+ *   parse      capture.parsers threads running parse_count(), each with
+ *              its own in and out queue
+ *   aggregate  takes the parsed packets back in the same round robin, so
+ *              in capture order, ticks the windows and counts them with
+ *              hist_add(), then hands each closed window on to
+ *   vectorize  which turns the window into feature vectors and keeps
+ *              them, window_keep()
+ *
+ * Projection, clustering and classification still run once the capture
+ * is over, on the windows kept, as they do without the pipeline.
+ *
+ * Taking the queues in the order they were filled keeps the packets in
+ * order without a multi-producer queue, so windows come out exactly as
+ * without the pipeline.
+ *
+ * Only the parse queues ever fill up in practice.  With overflow = block
+ * the capture waits for room, the right thing for files.  With
+ * overflow = drop a live capture drops the packet and counts it, and
+ * never waits on a slow later stage.  The later stages always wait on each
+ * other.  Each stage can be pinned to a core (cpu_capture, cpu_parse,
+ * cpu_aggregate, cpu_vectorize), its queues are then put on that core's NUMA
+ * node, see affinity.h.  Queue occupancy is part of the stats dump.
+ *
+ * Per packet alerts are left out in the pipeline, the output ring takes
+ * one thread at a time.
+ */
+
+#include <pcap.h>
+
+#include "hbtad.h"
+
+// most parse threads
+#define PIPE_MAX_PARSERS 32
+
+// bytes of a packet copied from the IP header on, parse_ip() needs the
+// IP and TCP headers at most
+#define PIPE_SNAP 128
+
+// start the stage threads with the settings in capture, 0 on success
+int pipeline_start(void);
+
+// drain every stage and join the threads
+void pipeline_stop(void);
+
+// capture side, in place of got_ip() and got_packet()
+void pipeline_ip(const struct pcap_pkthdr *h, const u_char *l3, int len);
+void pipeline_packet(u_char *args, const struct pcap_pkthdr *h, const u_char *packet);
+
+// hand a closed window (one hist per tenant) to the vectorize stage, -1 if
+// the pipeline isn't running
+int pipeline_window(long start, const struct hist *h);
+
+#endif
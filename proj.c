@@ -0,0 +1,540 @@
+/*
+ * Metric space mapping, see proj.h.
+ *
+ * PCA uses the randomized range finder of Halko, Martinsson and Tropp:
+ * project the centered training matrix X (n x D) onto a few random
+ * directions, sharpen that subspace with a couple of power iterations,
+ * then solve the small eigenproblem of B B^T with B = Q^T X.  Nothing
+ * bigger than n x D is ever held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "proj.h"
+
+// extra random directions and power iterations for the range finder
+#define PCA_OVERSAMPLE 10
+#define PCA_POWER_ITERS 2
+
+// jacobi sweeps before we give up on the small eigenproblem
+#define JACOBI_MAX_SWEEPS 100
+
+static unsigned long long proj_rng;
+
+static unsigned long long rng_next(void)
+{
+    // xorshift64*
+    proj_rng ^= proj_rng >> 12;
+    proj_rng ^= proj_rng << 25;
+    proj_rng ^= proj_rng >> 27;
+    return proj_rng * 2685821657736338717ULL;
+}
+
+static double rng_gauss(void)
+{
+    double u1 = ((rng_next() >> 11) + 1.0) * (1.0 / 9007199254740993.0);
+    double u2 = (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+
+    return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+void proj_none(struct projection *p, int in_len)
+{
+    memset(p, 0, sizeof(*p));
+    p->mode = PROJ_NONE;
+    p->in_len = in_len;
+    p->out_len = in_len;
+}
+
+// orthonormalize the columns of the rows x cols row major matrix a,
+// modified gram-schmidt, columns that vanish are left as zero
+static void orth_cols(double *a, int rows, int cols)
+{
+    int i, c, k;
+    double dot, norm;
+
+    for (c = 0; c < cols; c++)
+    {
+        for (k = 0; k < c; k++)
+        {
+            dot = 0;
+            for (i = 0; i < rows; i++)
+                dot += a[i*cols + c]*a[i*cols + k];
+            for (i = 0; i < rows; i++)
+                a[i*cols + c] -= dot*a[i*cols + k];
+        }
+
+        norm = 0;
+        for (i = 0; i < rows; i++)
+            norm += a[i*cols + c]*a[i*cols + c];
+        norm = sqrt(norm);
+
+        for (i = 0; i < rows; i++)
+            a[i*cols + c] = norm > 1e-12 ? a[i*cols + c]/norm : 0;
+    }
+}
+
+// eigen decomposition of the symmetric l x l matrix a (destroyed),
+// eigenvalues in w, eigenvectors in the columns of v, sorted descending
+static void jacobi_eigen(double *a, int l, double *w, double *v)
+{
+    int sweep, p, q, i, j, best;
+    double off, theta, t, c, s, apq, tmp;
+
+    for (i = 0; i < l; i++)
+        for (j = 0; j < l; j++)
+            v[i*l + j] = i == j;
+
+    for (sweep = 0; sweep < JACOBI_MAX_SWEEPS; sweep++)
+    {
+        off = 0;
+        for (p = 0; p < l; p++)
+            for (q = p + 1; q < l; q++)
+                off += a[p*l + q]*a[p*l + q];
+        if (off < 1e-22)
+            break;
+
+        for (p = 0; p < l; p++)
+        {
+            for (q = p + 1; q < l; q++)
+            {
+                apq = a[p*l + q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+
+                theta = (a[q*l + q] - a[p*l + p])/(2*apq);
+                t = (theta >= 0 ? 1 : -1)/(fabs(theta) + sqrt(theta*theta + 1));
+                c = 1/sqrt(t*t + 1);
+                s = t*c;
+
+                for (i = 0; i < l; i++)
+                {
+                    tmp = a[i*l + p];
+                    a[i*l + p] = c*tmp - s*a[i*l + q];
+                    a[i*l + q] = s*tmp + c*a[i*l + q];
+                }
+                for (i = 0; i < l; i++)
+                {
+                    tmp = a[p*l + i];
+                    a[p*l + i] = c*tmp - s*a[q*l + i];
+                    a[q*l + i] = s*tmp + c*a[q*l + i];
+                }
+                for (i = 0; i < l; i++)
+                {
+                    tmp = v[i*l + p];
+                    v[i*l + p] = c*tmp - s*v[i*l + q];
+                    v[i*l + q] = s*tmp + c*v[i*l + q];
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < l; i++)
+        w[i] = a[i*l + i];
+
+    // selection sort, l is tiny
+    for (i = 0; i < l; i++)
+    {
+        best = i;
+        for (j = i + 1; j < l; j++)
+            if (w[j] > w[best])
+                best = j;
+        if (best == i)
+            continue;
+
+        tmp = w[i];
+        w[i] = w[best];
+        w[best] = tmp;
+        for (j = 0; j < l; j++)
+        {
+            tmp = v[j*l + i];
+            v[j*l + i] = v[j*l + best];
+            v[j*l + best] = tmp;
+        }
+    }
+}
+
+int proj_pca(struct projection *p, int **vecs, int n, int in_len, int out_len, unsigned long seed)
+{
+    int D = in_len, l, i, j, c, k, it;
+    double *mean, *y, *z, *b, *bbt, *w, *u, s;
+    float *x, *row;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark;
+
+    memset(p, 0, sizeof(*p));
+
+    if (n < 2)
+    {
+        fprintf(stderr, "ERROR! proj_pca: need at least 2 training windows, got %d\n", n);
+        return -1;
+    }
+
+    l = out_len + PCA_OVERSAMPLE;
+    if (l > n)
+        l = n;
+    if (l > D)
+        l = D;
+    if (out_len > l)
+        out_len = l;
+
+    proj_rng = seed ? seed : 1;
+
+    // the working set is scratch, only the basis outlives the call
+    mark = arena_mark(scratch);
+    mean = arena_zalloc(scratch, D*sizeof(double));
+    x = arena_alloc(scratch, (size_t)n*D*sizeof(float));
+    y = arena_alloc(scratch, (size_t)n*l*sizeof(double));
+    z = arena_alloc(scratch, (size_t)D*l*sizeof(double));
+    b = arena_alloc(scratch, (size_t)l*D*sizeof(double));
+    bbt = arena_alloc(scratch, (size_t)l*l*sizeof(double));
+    w = arena_alloc(scratch, l*sizeof(double));
+    u = arena_alloc(scratch, (size_t)l*l*sizeof(double));
+    p->basis = calloc((size_t)D*out_len, sizeof(float));
+    p->offset = calloc(out_len, sizeof(float));
+
+    if (!p->basis || !p->offset)
+    {
+        fprintf(stderr, "ERROR! proj_pca: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // center the training windows
+    for (i = 0; i < n; i++)
+        for (j = 0; j < D; j++)
+            mean[j] += vecs[i][j];
+    for (j = 0; j < D; j++)
+        mean[j] /= n;
+    for (i = 0; i < n; i++)
+        for (j = 0; j < D; j++)
+            x[(size_t)i*D + j] = vecs[i][j] - mean[j];
+
+    // z = random D x l, y = x z
+    for (j = 0; j < D*l; j++)
+        z[j] = rng_gauss();
+
+    for (it = 0; it <= PCA_POWER_ITERS; it++)
+    {
+        if (it > 0)
+        {
+            // z = x^T y
+            memset(z, 0, (size_t)D*l*sizeof(double));
+            for (i = 0; i < n; i++)
+            {
+                row = x + (size_t)i*D;
+                for (j = 0; j < D; j++)
+                    if (row[j] != 0)
+                        for (c = 0; c < l; c++)
+                            z[(size_t)j*l + c] += row[j]*y[i*l + c];
+            }
+            orth_cols(z, D, l);
+        }
+
+        memset(y, 0, (size_t)n*l*sizeof(double));
+        for (i = 0; i < n; i++)
+        {
+            row = x + (size_t)i*D;
+            for (j = 0; j < D; j++)
+                if (row[j] != 0)
+                    for (c = 0; c < l; c++)
+                        y[i*l + c] += row[j]*z[(size_t)j*l + c];
+        }
+        orth_cols(y, n, l);
+    }
+
+    // b = y^T x, the data in the found subspace
+    memset(b, 0, (size_t)l*D*sizeof(double));
+    for (i = 0; i < n; i++)
+    {
+        row = x + (size_t)i*D;
+        for (c = 0; c < l; c++)
+            for (j = 0; j < D; j++)
+                b[(size_t)c*D + j] += y[i*l + c]*row[j];
+    }
+
+    for (c = 0; c < l; c++)
+        for (k = c; k < l; k++)
+        {
+            s = 0;
+            for (j = 0; j < D; j++)
+                s += b[(size_t)c*D + j]*b[(size_t)k*D + j];
+            bbt[c*l + k] = bbt[k*l + c] = s;
+        }
+
+    jacobi_eigen(bbt, l, w, u);
+
+    // principal directions v_k = b^T u_k / sqrt(w_k)
+    for (k = 0; k < out_len; k++)
+    {
+        if (w[k] <= 1e-9)
+            continue;
+
+        for (j = 0; j < D; j++)
+        {
+            s = 0;
+            for (c = 0; c < l; c++)
+                s += b[(size_t)c*D + j]*u[c*l + k];
+            p->basis[(size_t)j*out_len + k] = s/sqrt(w[k]);
+        }
+    }
+
+    for (k = 0; k < out_len; k++)
+    {
+        s = 0;
+        for (j = 0; j < D; j++)
+            s += mean[j]*p->basis[(size_t)j*out_len + k];
+        p->offset[k] = s;
+    }
+
+    p->mode = PROJ_PCA;
+    p->in_len = D;
+    p->out_len = out_len;
+
+    arena_release(scratch, mark);
+
+    return 0;
+}
+
+int proj_random(struct projection *p, int in_len, int out_len, unsigned long seed)
+{
+    int j, i, nnz, cap;
+    double s = sqrt((double)in_len);
+    unsigned long long thresh;
+
+    memset(p, 0, sizeof(*p));
+
+    proj_rng = seed ? seed : 1;
+    thresh = (unsigned long long)(18446744073709551615.0/s);
+
+    cap = (int)(2.0*in_len*out_len/s) + out_len + 16;
+    p->col_start = malloc((in_len + 1)*sizeof(int));
+    p->rows = malloc(cap*sizeof(int));
+    p->signs = malloc(cap);
+    if (!p->col_start || !p->rows || !p->signs)
+    {
+        fprintf(stderr, "ERROR! proj_random: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    nnz = 0;
+    for (j = 0; j < in_len; j++)
+    {
+        p->col_start[j] = nnz;
+        for (i = 0; i < out_len; i++)
+        {
+            if (rng_next() >= thresh)
+                continue;
+
+            if (nnz == cap)
+            {
+                cap *= 2;
+                p->rows = realloc(p->rows, cap*sizeof(int));
+                p->signs = realloc(p->signs, cap);
+                if (!p->rows || !p->signs)
+                {
+                    fprintf(stderr, "ERROR! proj_random: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            p->rows[nnz] = i;
+            p->signs[nnz] = (rng_next() >> 63) ? 1 : -1;
+            nnz++;
+        }
+    }
+    p->col_start[in_len] = nnz;
+
+    p->mode = PROJ_RANDOM;
+    p->in_len = in_len;
+    p->out_len = out_len;
+    p->scale = sqrt(s/out_len);
+
+    return 0;
+}
+
+int proj_parse(struct projection *p, const char *spec)
+{
+    const char *colon = strchr(spec, ':');
+    int dims = colon ? atoi(colon + 1) : PROJ_DIMS;
+
+    memset(p, 0, sizeof(*p));
+
+    if (strcmp(spec, "none") == 0)
+        p->mode = PROJ_NONE;
+    else if (strncmp(spec, "pca", 3) == 0 && (spec[3] == ':' || spec[3] == '\0'))
+        p->mode = PROJ_PCA;
+    else if (strncmp(spec, "random", 6) == 0 && (spec[6] == ':' || spec[6] == '\0'))
+        p->mode = PROJ_RANDOM;
+    else
+    {
+        fprintf(stderr, "ERROR! proj: unknown mapping '%s'\n", spec);
+        return -1;
+    }
+
+    if (p->mode != PROJ_NONE && dims < 1)
+    {
+        fprintf(stderr, "ERROR! proj: bad dimension count in '%s'\n", spec);
+        return -1;
+    }
+
+    p->out_len = dims;
+
+    return 0;
+}
+
+void proj_apply(const struct projection *p, const int *in, float *out)
+{
+    const float *row;
+    float v;
+    int j, k, e;
+
+    switch (p->mode)
+    {
+        case PROJ_NONE:
+            for (j = 0; j < p->in_len; j++)
+                out[j] = in[j];
+            break;
+
+        case PROJ_PCA:
+            for (k = 0; k < p->out_len; k++)
+                out[k] = -p->offset[k];
+            for (j = 0; j < p->in_len; j++)
+            {
+                if (in[j] == 0)
+                    continue;
+                v = in[j];
+                row = p->basis + (size_t)j*p->out_len;
+                for (k = 0; k < p->out_len; k++)
+                    out[k] += v*row[k];
+            }
+            break;
+
+        case PROJ_RANDOM:
+            for (k = 0; k < p->out_len; k++)
+                out[k] = 0;
+            for (j = 0; j < p->in_len; j++)
+            {
+                if (in[j] == 0)
+                    continue;
+                for (e = p->col_start[j]; e < p->col_start[j + 1]; e++)
+                    out[p->rows[e]] += p->signs[e]*in[j];
+            }
+            for (k = 0; k < p->out_len; k++)
+                out[k] *= p->scale;
+            break;
+    }
+}
+
+void proj_free(struct projection *p)
+{
+    free(p->basis);
+    free(p->offset);
+    free(p->col_start);
+    free(p->rows);
+    free(p->signs);
+    memset(p, 0, sizeof(*p));
+}
+
+// raw dump of the mapping for a saved model, same machine endianness
+int proj_write(const struct projection *p, FILE *fp)
+{
+    int32_t hdr[3] = { p->mode, p->in_len, p->out_len };
+    int32_t nnz;
+
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+        return -1;
+
+    switch (p->mode)
+    {
+        case PROJ_PCA:
+            if (fwrite(p->basis, sizeof(float), (size_t)p->in_len*p->out_len, fp) != (size_t)p->in_len*p->out_len
+                || fwrite(p->offset, sizeof(float), p->out_len, fp) != (size_t)p->out_len)
+                return -1;
+            break;
+
+        case PROJ_RANDOM:
+            nnz = p->col_start[p->in_len];
+            if (fwrite(&p->scale, sizeof(float), 1, fp) != 1
+                || fwrite(p->col_start, sizeof(int), p->in_len + 1, fp) != (size_t)p->in_len + 1
+                || fwrite(p->rows, sizeof(int), nnz, fp) != (size_t)nnz
+                || fwrite(p->signs, 1, nnz, fp) != (size_t)nnz)
+                return -1;
+            break;
+    }
+
+    return 0;
+}
+
+// the sparse matrix indexes only what proj_apply() has room for
+static int random_ok(const struct projection *p)
+{
+    int j, e;
+
+    if (p->col_start[0] != 0)
+        return 0;
+    for (j = 0; j < p->in_len; j++)
+        if (p->col_start[j + 1] < p->col_start[j])
+            return 0;
+    for (e = 0; e < p->col_start[p->in_len]; e++)
+        if (p->rows[e] < 0 || p->rows[e] >= p->out_len)
+            return 0;
+
+    return 1;
+}
+
+int proj_read(struct projection *p, FILE *fp)
+{
+    int32_t hdr[3];
+    int nnz;
+
+    memset(p, 0, sizeof(*p));
+
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1 || hdr[1] < 1 || hdr[2] < 1)
+        return -1;
+
+    p->mode = hdr[0];
+    p->in_len = hdr[1];
+    p->out_len = hdr[2];
+
+    switch (p->mode)
+    {
+        case PROJ_NONE:
+            return p->out_len == p->in_len ? 0 : -1;
+
+        case PROJ_PCA:
+            p->basis = malloc((size_t)p->in_len*p->out_len*sizeof(float));
+            p->offset = malloc(p->out_len*sizeof(float));
+            if (!p->basis || !p->offset
+                || fread(p->basis, sizeof(float), (size_t)p->in_len*p->out_len, fp) != (size_t)p->in_len*p->out_len
+                || fread(p->offset, sizeof(float), p->out_len, fp) != (size_t)p->out_len)
+                break;
+            return 0;
+
+        case PROJ_RANDOM:
+            p->col_start = malloc(((size_t)p->in_len + 1)*sizeof(int));
+            if (!p->col_start
+                || fread(&p->scale, sizeof(float), 1, fp) != 1
+                || fread(p->col_start, sizeof(int), p->in_len + 1, fp) != (size_t)p->in_len + 1)
+                break;
+
+            nnz = p->col_start[p->in_len];
+            if (nnz < 0)
+                break;
+            p->rows = malloc(((size_t)nnz + 1)*sizeof(int));
+            p->signs = malloc(nnz + 1);
+            if (!p->rows || !p->signs
+                || fread(p->rows, sizeof(int), nnz, fp) != (size_t)nnz
+                || fread(p->signs, 1, nnz, fp) != (size_t)nnz
+                || !random_ok(p))
+                break;
+            return 0;
+    }
+
+    proj_free(p);
+    return -1;
+}
@@ -0,0 +1,64 @@
+#ifndef PROJ_H
+#define PROJ_H
+
+/*
+ * Mapping of window feature vectors into a small metric space.
+ *
+ * PCA learns a basis from training windows (randomized range finder, so
+ * the DxD covariance is never built).  The sparse random projection needs
+ * no training at all, which suits streaming; it keeps distances within a
+ * small factor (Johnson-Lindenstrauss) at a fraction of the cost.  Both
+ * only touch the nonzero histogram counts of a window.
+ */
+
+#include <stdio.h>
+
+enum proj_mode {
+    PROJ_NONE,
+    PROJ_PCA,
+    PROJ_RANDOM
+};
+
+// default number of output dimensions
+#define PROJ_DIMS 32
+
+struct projection {
+    int mode;
+    int in_len;
+    int out_len;
+
+    // pca: in_len x out_len basis, one row per input dimension, and the
+    // projected training mean which is subtracted from every output
+    float *basis;
+    float *offset;
+
+    // random: for every input dimension, the outputs it adds to (the
+    // entries are +-1 times scale), col_start has in_len + 1 entries
+    int *col_start;
+    int *rows;
+    signed char *signs;
+    float scale;
+};
+
+// identity, the raw counts as floats
+void proj_none(struct projection *p, int in_len);
+
+// learn a pca basis from n training vectors
+int proj_pca(struct projection *p, int **vecs, int n, int in_len, int out_len, unsigned long seed);
+
+// sparse random projection, density 1/sqrt(in_len)
+int proj_random(struct projection *p, int in_len, int out_len, unsigned long seed);
+
+// parse "none", "pca:N" or "random:N", only sets mode and out_len
+int proj_parse(struct projection *p, const char *spec);
+
+// map one vector, out must hold p->out_len floats
+void proj_apply(const struct projection *p, const int *in, float *out);
+
+// save and load a learned mapping, 0 on success
+int proj_write(const struct projection *p, FILE *fp);
+int proj_read(struct projection *p, FILE *fp);
+
+void proj_free(struct projection *p);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Bounded SPSC queues, see queue.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "affinity.h"
+#include "queue.h"
+
+static struct queue *queues;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void queue_unlist(struct queue *q)
+{
+    struct queue **p;
+
+    for (p = &queues; *p; p = &(*p)->next)
+        if (*p == q)
+        {
+            *p = q->next;
+            break;
+        }
+}
+
+int queue_init(struct queue *q, const char *name, unsigned int size, size_t slot_size, int node)
+{
+    struct queue **p;
+    unsigned int n = 1;
+
+    // a queue used again starts its metrics over, and gives back its slots
+    // if it wasn't freed
+    pthread_mutex_lock(&queue_lock);
+    queue_unlist(q);
+    pthread_mutex_unlock(&queue_lock);
+    queue_free(q);
+
+    while (n < size)
+        n <<= 1;
+
+    memset(q, 0, sizeof(*q));
+    q->mask = n - 1;
+    // keep slots from sharing cache lines
+    q->slot_size = (slot_size + 63) & ~(size_t)63;
+    snprintf(q->name, sizeof(q->name), "%s", name);
+
+    if ((q->slots = affinity_alloc(n*q->slot_size, node)) == NULL)
+    {
+        fprintf(stderr, "ERROR! queue: out of memory for %s\n", name);
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    for (p = &queues; *p; p = &(*p)->next)
+        ;
+    *p = q;
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+void queue_free(struct queue *q)
+{
+    affinity_free(q->slots, (q->mask + 1)*q->slot_size);
+    q->slots = NULL;
+}
+
+void queue_dump(FILE *fp)
+{
+    struct queue *q;
+    uint64_t pushed;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queues)
+        fprintf(fp, "%-12s %12s %10s %10s %8s %8s %8s\n",
+                "queue", "pushed", "dropped", "blocked", "size", "mean", "max");
+    for (q = queues; q; q = q->next)
+    {
+        pushed = __atomic_load_n(&q->pushed, __ATOMIC_RELAXED);
+        fprintf(fp, "%-12s %12llu %10llu %10llu %8u %8.1f %8llu\n", q->name,
+                (unsigned long long)pushed,
+                (unsigned long long)__atomic_load_n(&q->dropped, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&q->blocked, __ATOMIC_RELAXED),
+                q->mask + 1,
+                pushed ? (double)__atomic_load_n(&q->depth_sum, __ATOMIC_RELAXED)/pushed : 0.0,
+                (unsigned long long)__atomic_load_n(&q->depth_max, __ATOMIC_RELAXED));
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
@@ -0,0 +1,136 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/*
+ * Bounded single-producer/single-consumer queue of fixed-size slots.
+ *
+ * The same ring as the output writer's: head is only written by the
+ * producer, tail only by the consumer, each on its own cache line.  Each
+ * side also keeps a copy of the other side's index and only reads the
+ * shared one again when its copy says the ring is full or empty.  In the
+ * steady state, a push or pop then touches no line the other side writes.
+ *
+ * The producer fills a slot in place (queue_slot(), then queue_push()) and
+ * the consumer reads it in place (queue_peek(), then queue_pop()), so
+ * nothing is copied twice.
+ *
+ * Each queue keeps occupancy metrics, written by its producer only: slots
+ * pushed, pushes dropped or held up on a full queue, the mean and the
+ * highest depth seen.  The depth is taken from the cached tail, looked at
+ * afresh every 64 pushes, so it may be up to that much too high.
+ * queue_dump() prints them.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct queue {
+    _Alignas(64) atomic_uint head;
+    unsigned int tail_seen;         // producer's copy of tail
+    uint64_t pushed;
+    uint64_t dropped;
+    uint64_t blocked;
+    uint64_t depth_sum;
+    uint64_t depth_max;
+
+    _Alignas(64) atomic_uint tail;
+    unsigned int head_seen;         // consumer's copy of head
+
+    _Alignas(64) unsigned int mask;
+    size_t slot_size;
+    char *slots;
+    atomic_int closed;              // the producer is done
+    char name[32];
+    struct queue *next;             // all queues, for queue_dump()
+};
+
+// size slots (rounded up to a power of 2) of slot_size bytes each, on NUMA
+// node (-1 for the caller's), 0 on success.  q is zeroed or was initialised
+// before, on failure it holds nothing to free
+int queue_init(struct queue *q, const char *name, unsigned int size, size_t slot_size, int node);
+void queue_free(struct queue *q);
+
+// metrics of every initialised queue, freed ones included
+void queue_dump(FILE *fp);
+
+// producer: a free slot to fill, NULL if the queue is full
+static inline void *queue_slot(struct queue *q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head - q->tail_seen > q->mask)
+    {
+        q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - q->tail_seen > q->mask)
+            return NULL;
+    }
+
+    return q->slots + (head & q->mask)*q->slot_size;
+}
+
+// producer: hand over the slot from queue_slot()
+static inline void queue_push(struct queue *q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint64_t depth;
+
+    // the cached tail lags, look at the real one now and then for the depth.
+    // queue_slot() reuses slots on the strength of it, so this is an acquire
+    // like its own: the consumer's reads of a slot come before it is refilled
+    if ((head & 63) == 0)
+        q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+    depth = head - q->tail_seen + 1;
+
+    __atomic_store_n(&q->pushed, q->pushed + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->depth_sum, q->depth_sum + depth, __ATOMIC_RELAXED);
+    if (depth > q->depth_max)
+        __atomic_store_n(&q->depth_max, depth, __ATOMIC_RELAXED);
+
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+// producer: count a push that couldn't go in, dropped or held up
+static inline void queue_full(struct queue *q, int dropped)
+{
+    if (dropped)
+        __atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&q->blocked, q->blocked + 1, __ATOMIC_RELAXED);
+}
+
+// producer: no more pushes, the consumer drains what is left
+static inline void queue_close(struct queue *q)
+{
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+}
+
+// consumer: the oldest slot, NULL if the queue is empty
+static inline void *queue_peek(struct queue *q)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if (tail == q->head_seen)
+    {
+        q->head_seen = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == q->head_seen)
+            return NULL;
+    }
+
+    return q->slots + (tail & q->mask)*q->slot_size;
+}
+
+// consumer: done with the slot from queue_peek()
+static inline void queue_pop(struct queue *q)
+{
+    atomic_store_explicit(&q->tail, atomic_load_explicit(&q->tail, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+// consumer: closed and nothing left
+static inline int queue_done(struct queue *q)
+{
+    return atomic_load_explicit(&q->closed, memory_order_acquire) && !queue_peek(q);
+}
+
+#endif
@@ -0,0 +1,563 @@
+/*
+ * Multi-file capture replay, see replay.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "hbtad.h"
+#include "hist.h"
+#include "config.h"
+#include "output.h"
+#include "stats.h"
+#include "pcapng.h"
+#include "zfile.h"
+#include "affinity.h"
+#include "replay.h"
+
+struct source {
+    const char *path;
+    pcap_t *pcap;               // pcap, plain or compressed
+    int l3_off;                 // its frames' link header, see link_l3_off()
+    int ether;                  // or read from each frame, ether_l3_off()
+    struct pcapng *ng;          // or pcapng read natively
+};
+
+struct source *source_open(const char *path)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    struct source *s;
+    FILE *fp;
+
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+    {
+        fprintf(stderr, "ERROR! replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    s->path = path;
+
+    /* pcapng is read natively, straight out of the mapped file */
+    if (pcapng_is(path))
+    {
+        if ((s->ng = pcapng_open(path, capture.filter)) == NULL)
+            goto fail;
+        return s;
+    }
+
+    /* compressed files are decompressed on the fly by a thread of their own */
+    if (zfile_format(path) != ZFILE_NONE)
+    {
+        if ((fp = zfile_open(path)) == NULL)
+            goto fail;
+        if ((s->pcap = pcap_fopen_offline(fp, errbuf)) == NULL)
+            fclose(fp);
+    }
+    else
+        s->pcap = pcap_open_offline(path, errbuf);
+
+    if (!s->pcap)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", path, errbuf);
+        goto fail;
+    }
+
+    /* the IP header is found the same way as in pcapng */
+    if ((s->l3_off = link_l3_off(pcap_datalink(s->pcap))) < 0)
+    {
+        fprintf(stderr, "Unable to read %s: unsupported link type %d\n", path,
+                pcap_datalink(s->pcap));
+        goto fail;
+    }
+
+    s->ether = pcap_datalink(s->pcap) == DLT_EN10MB;
+
+    /* a file has no network to go with the filter */
+    set_filter(s->pcap, PCAP_NETMASK_UNKNOWN);
+
+    return s;
+
+fail:
+    if (s->pcap)
+        pcap_close(s->pcap);
+    free(s);
+    return NULL;
+}
+
+int source_next(struct source *s, struct pcap_pkthdr *h, const u_char **l3, int *len)
+{
+    struct pcap_pkthdr *ph;
+    const u_char *data;
+    int ret, off;
+
+    if (s->ng)
+        return pcapng_next(s->ng, h, l3, len);
+
+    if ((ret = pcap_next_ex(s->pcap, &ph, &data)) == 1)
+    {
+        *h = *ph;
+        off = s->ether ? ether_l3_off(data, (int)h->caplen) : s->l3_off;
+        *l3 = data + off;
+        *len = (int)h->caplen - off;
+        return 1;
+    }
+
+    // a truncated file ends the read, as it always has
+    if (ret == -1)
+        fprintf(stderr, "warning: %s: %s\n", s->path, pcap_geterr(s->pcap));
+    return 0;
+}
+
+void source_close(struct source *s)
+{
+    if (!s)
+        return;
+
+    if (s->ng)
+        pcapng_close(s->ng);
+    if (s->pcap)
+        pcap_close(s->pcap);
+    free(s);
+}
+
+static char *replay_strdup(const char *s)
+{
+    char *d = strdup(s);
+
+    if (!d)
+    {
+        fprintf(stderr, "ERROR! replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+static void replay_push(char ***files, int *n, int *cap, char *path)
+{
+    if (*n == *cap)
+    {
+        *cap = *cap ? 2 * *cap : 64;
+        if ((*files = realloc(*files, *cap*sizeof(**files))) == NULL)
+        {
+            fprintf(stderr, "ERROR! replay: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*files)[(*n)++] = path;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int replay_files(char **paths, int n, char ***files)
+{
+    struct dirent *e;
+    struct stat st;
+    char *path;
+    DIR *d;
+    int i, first, num = 0, cap = 0;
+
+    *files = NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        if (stat(paths[i], &st) != 0)
+        {
+            fprintf(stderr, "ERROR! replay: %s: %s\n", paths[i], strerror(errno));
+            goto fail;
+        }
+
+        if (!S_ISDIR(st.st_mode))
+        {
+            replay_push(files, &num, &cap, replay_strdup(paths[i]));
+            continue;
+        }
+
+        if ((d = opendir(paths[i])) == NULL)
+        {
+            fprintf(stderr, "ERROR! replay: %s: %s\n", paths[i], strerror(errno));
+            goto fail;
+        }
+
+        // regular files only, and no hidden ones such as half written captures
+        first = num;
+        while ((e = readdir(d)) != NULL)
+        {
+            if (e->d_name[0] == '.')
+                continue;
+            if ((path = malloc(strlen(paths[i]) + strlen(e->d_name) + 2)) == NULL)
+            {
+                fprintf(stderr, "ERROR! replay: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            sprintf(path, "%s/%s", paths[i], e->d_name);
+            if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+                replay_push(files, &num, &cap, path);
+            else
+                free(path);
+        }
+        closedir(d);
+
+        qsort(*files + first, num - first, sizeof(**files), by_name);
+    }
+
+    // packets at the same time go in file order, make that independent of
+    // the order on the command line
+    if (capture.deterministic)
+        qsort(*files, num, sizeof(**files), by_name);
+
+    if (num == 0)
+    {
+        fprintf(stderr, "ERROR! replay: no capture files\n");
+        goto fail;
+    }
+
+    return num;
+
+fail:
+    replay_free(*files, num);
+    *files = NULL;
+    return -1;
+}
+
+void replay_free(char **files, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        free(files[i]);
+    free(files);
+}
+
+// a file in the merge, with its next packet
+struct entry {
+    int idx;                    // position on the command line, breaks ties
+    struct timeval first;       // timestamp of its first packet
+    struct source *src;
+    struct pcap_pkthdr h;
+    const u_char *l3;
+    int len;
+};
+
+static int earlier(const struct timeval *a, int ai, const struct timeval *b, int bi)
+{
+    if (a->tv_sec != b->tv_sec)
+        return a->tv_sec < b->tv_sec;
+    if (a->tv_usec != b->tv_usec)
+        return a->tv_usec < b->tv_usec;
+    return ai < bi;
+}
+
+static int by_first(const void *a, const void *b)
+{
+    const struct entry *x = a, *y = b;
+
+    return earlier(&x->first, x->idx, &y->first, y->idx) ? -1 : 1;
+}
+
+static void heap_down(struct entry **heap, int n, int i)
+{
+    struct entry *e = heap[i];
+    int c;
+
+    while ((c = 2*i + 1) < n)
+    {
+        if (c + 1 < n && earlier(&heap[c + 1]->h.ts, heap[c + 1]->idx, &heap[c]->h.ts, heap[c]->idx))
+            c++;
+        if (!earlier(&heap[c]->h.ts, heap[c]->idx, &e->h.ts, e->idx))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = e;
+}
+
+static void heap_up(struct entry **heap, int i)
+{
+    struct entry *e = heap[i];
+
+    while (i > 0 && earlier(&e->h.ts, e->idx, &heap[(i - 1)/2]->h.ts, heap[(i - 1)/2]->idx))
+    {
+        heap[i] = heap[(i - 1)/2];
+        i = (i - 1)/2;
+    }
+    heap[i] = e;
+}
+
+// have the page cache start on path before it is opened
+static void prefetch(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+// replay clock, packets are due at their capture time offset from the
+// first one, divided by the speed
+struct pace {
+    double speed;
+    double start;               // monotonic ns at the first packet
+    struct timeval first;       // and its capture time
+    double max_lag;
+};
+
+static volatile sig_atomic_t replay_stop;
+
+static void replay_on_signal(int sig)
+{
+    replay_stop = 1;
+}
+
+static double mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// sleep until h is due, returns when that was
+static double pace_wait(struct pace *p, const struct pcap_pkthdr *h)
+{
+    struct timespec ts;
+    double due;
+
+    if (p->start == 0)
+    {
+        p->start = mono_ns();
+        p->first = h->ts;
+    }
+
+    // a packet from before the first one is due at once
+    due = ((h->ts.tv_sec - p->first.tv_sec)*1e9 + (h->ts.tv_usec - p->first.tv_usec)*1e3)/p->speed;
+    due = p->start + (due > 0 ? due : 0);
+
+    if (mono_ns() < due)
+    {
+        ts.tv_sec = (time_t)(due/1e9);
+        ts.tv_nsec = (long)(due - ts.tv_sec*1e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0 && !replay_stop)
+            ;
+    }
+
+    return due;
+}
+
+// how late h was done, from when it was due
+static void pace_done(struct pace *p, double due)
+{
+    double lag = mono_ns() - due;
+
+    STAT_RECORD_NS(STAGE_REPLAY, lag);
+    if (lag > p->max_lag)
+        p->max_lag = lag;
+}
+
+int replay(char **files, int n, replay_handler cb, double speed)
+{
+    struct pace pace = { speed };
+    double due = 0;
+    struct entry *entries, **heap;
+    struct pcap_pkthdr h;
+    const u_char *l3;
+    struct entry *e;
+    int i, len, m, next, nheap = 0, warned = 0, ret = -1;
+    long count = 0;
+
+    if ((entries = calloc(n, sizeof(*entries))) == NULL
+        || (heap = malloc(n*sizeof(*heap))) == NULL)
+    {
+        fprintf(stderr, "ERROR! replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // find where every file starts, empty ones are left out, one that
+    // can't be read fails the replay (the reader has said why)
+    for (i = 0, m = 0; i < n; i++)
+    {
+        e = &entries[m];
+        if ((e->src = source_open(files[i])) == NULL)
+            goto out;
+        e->idx = i;
+        if ((next = source_next(e->src, &h, &l3, &len)) < 0)
+            goto out;
+        if (next == 1)
+        {
+            e->first = h.ts;
+            m++;
+        }
+        source_close(e->src);
+        e->src = NULL;
+    }
+    qsort(entries, m, sizeof(*entries), by_first);
+
+    // a paced replay runs until interrupted, like a live capture
+    if (speed > 0)
+    {
+        replay_stop = 0;
+        signal(SIGINT, replay_on_signal);
+        signal(SIGTERM, replay_on_signal);
+    }
+
+    for (next = 0;;)
+    {
+        // open every file that starts no later than the earliest packet
+        while (next < m && (nheap == 0 || !earlier(&heap[0]->h.ts, heap[0]->idx,
+                                                   &entries[next].first, entries[next].idx)))
+        {
+            if (nheap == capture.readers)
+            {
+                if (!warned)
+                    fprintf(stderr, "warning: more than %d files overlap in time, "
+                            "packets may be out of order\n", capture.readers);
+                warned = 1;
+                break;
+            }
+
+            e = &entries[next++];
+            if ((e->src = source_open(files[e->idx])) == NULL)
+                goto out;
+            if (next < m)
+                prefetch(files[entries[next].idx]);
+
+            // it had a packet when peeked at, but may have changed since
+            if ((i = source_next(e->src, &e->h, &e->l3, &e->len)) != 1)
+            {
+                if (i < 0)
+                    goto out;
+                source_close(e->src);
+                e->src = NULL;
+                continue;
+            }
+            heap[nheap] = e;
+            heap_up(heap, nheap++);
+        }
+
+        if (nheap == 0)
+            break;
+
+        e = heap[0];
+        if (speed > 0)
+        {
+            due = pace_wait(&pace, &e->h);
+            if (replay_stop)
+                break;
+        }
+        cb(&e->h, e->l3, e->len);
+        if (speed > 0)
+            pace_done(&pace, due);
+        if (capture.count && ++count == capture.count)
+            break;
+
+        if ((i = source_next(e->src, &e->h, &e->l3, &e->len)) == 1)
+            heap_down(heap, nheap, 0);
+        else
+        {
+            if (i < 0)
+                goto out;
+            source_close(e->src);
+            e->src = NULL;
+            heap[0] = heap[--nheap];
+            if (nheap > 0)
+                heap_down(heap, nheap, 0);
+        }
+    }
+
+    ret = 0;
+
+    if (speed > 0)
+        out_printf("Replayed at %gx, at most %.3f ms behind\n", speed, pace.max_lag/1e6);
+
+out:
+    if (speed > 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+    }
+    for (i = 0; i < n; i++)
+        source_close(entries[i].src);
+    free(entries);
+    free(heap);
+
+    return ret;
+}
+
+struct replay_work {
+    char **files;
+    int n;
+    replay_handler cb;
+    atomic_int next;            // next file to take
+    atomic_long count;          // packets so far, for capture.count
+    atomic_int failed;
+    atomic_int started;         // threads so far, for their cores
+};
+
+static void *replay_worker(void *arg)
+{
+    struct replay_work *w = arg;
+    struct pcap_pkthdr h;
+    const u_char *l3;
+    struct source *s;
+    int i, len, ret;
+
+    i = atomic_fetch_add(&w->started, 1);
+    affinity_pin("reader", capture.cpu_workers < 0 ? -1 : capture.cpu_workers + i);
+
+    while ((i = atomic_fetch_add(&w->next, 1)) < w->n && !atomic_load(&w->failed)
+           && !(capture.count && atomic_load(&w->count) >= capture.count))
+    {
+        if ((s = source_open(w->files[i])) == NULL)
+        {
+            atomic_store(&w->failed, 1);
+            break;
+        }
+
+        while ((ret = source_next(s, &h, &l3, &len)) == 1)
+        {
+            if (capture.count && atomic_fetch_add(&w->count, 1) >= capture.count)
+                break;
+            w->cb(&h, l3, len);
+        }
+        source_close(s);
+
+        if (ret < 0)
+            atomic_store(&w->failed, 1);
+    }
+
+    return NULL;
+}
+
+int replay_parallel(char **files, int n, replay_handler cb)
+{
+    struct replay_work w = { files, n, cb };
+    pthread_t threads[HIST_MAX_SHARDS];
+    int i, num = capture.threads < n ? capture.threads : n;
+
+    for (i = 0; i < num; i++)
+        if (pthread_create(&threads[i], NULL, replay_worker, &w) != 0)
+        {
+            fprintf(stderr, "ERROR! replay: unable to create reader thread\n");
+            atomic_store(&w.failed, 1);
+            break;
+        }
+
+    num = i;
+    for (i = 0; i < num; i++)
+        pthread_join(threads[i], NULL);
+
+    return atomic_load(&w.failed) ? -1 : 0;
+}
@@ -0,0 +1,69 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/*
+ * Reading any number of capture files as one stream.
+ *
+ * A source is one file read a packet at a time: pcap, pcapng (see
+ * pcapng.h), or either of them compressed (see zfile.h).  Directories on
+ * the command line stand for the files in them, in name order.
+ *
+ * replay() merges the files by capture time so that windows come out the
+ * same as from one big file.  Every file is peeked at for its first
+ * timestamp, then the files are opened in that order, each one only when
+ * the merge gets to its first packet.  Open files sit in a heap keyed by
+ * their next packet.  For rotating captures from several taps that keeps
+ * about one file per tap open, however many files there are.  No more
+ * than capture.readers files are ever open; past that, a file waits for
+ * one to close and the merge warns that it may be out of order.  When a
+ * file is opened, the kernel is asked to read ahead the next one.
+ *
+ * The peek is a whole open and close of each file, and the merge opens it
+ * again from the start, so a compressed file starts its decompression
+ * thread twice and decompresses its first block twice.  Keeping the
+ * peeked files open instead would hold every file open at once, the
+ * limit above is worth more.
+ *
+ * With a speed, packets are paced by their timestamps (speed 1 is real
+ * time, 10 ten times as fast) and go through the same path as a live
+ * capture, window closes included.  How late each packet is done, counted
+ * from its due time, goes into the "replay" latency stage.  That is the
+ * end-to-end delay, and it grows when the pipeline can't keep up.
+ * SIGINT stops a paced replay.
+ *
+ * Without windows (HBTAD_WINDOW=0) the order doesn't matter.
+ * replay_parallel() then gives whole files to capture.threads threads,
+ * each counting into its own histogram shard.
+ */
+
+#include <pcap.h>
+
+// called with each packet, l3 is its IP header and len the bytes captured
+// from there on, less than 0 when the capture stops short of it
+typedef void (*replay_handler)(const struct pcap_pkthdr *h, const u_char *l3, int len);
+
+struct source;
+
+// open a capture file of any kind, NULL on errors
+struct source *source_open(const char *path);
+
+// the next packet, 1 for a packet, 0 at the end, -1 on errors.  The packet
+// stays valid until the next call
+int source_next(struct source *s, struct pcap_pkthdr *h, const u_char **l3, int *len);
+
+void source_close(struct source *s);
+
+// the files named by paths, with directories expanded, into *files.  The
+// count, or -1 on errors.  Free with replay_free()
+int replay_files(char **paths, int n, char ***files);
+void replay_free(char **files, int n);
+
+// feed every packet in files to cb in capture time order, stopping after
+// capture.count packets if set.  speed paces them, 0 for flat out.  0 on
+// success
+int replay(char **files, int n, replay_handler cb, double speed);
+
+// the same in no particular order, cb is called from several threads
+int replay_parallel(char **files, int n, replay_handler cb);
+
+#endif
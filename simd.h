@@ -0,0 +1,197 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * A small vector layer over AVX, SSE2 or plain floats, whichever the
+ * compiler targets (-mavx, -march=native, ...).  vf holds VF_W floats.
+ * vf_loada wants a 32 byte aligned pointer, matrix rows always are.
+ */
+
+#include <math.h>
+#include <string.h>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+
+typedef __m256 vf;
+#define VF_W 8
+#define vf_load(p)      _mm256_loadu_ps(p)
+#define vf_loada(p)     _mm256_load_ps(p)
+#define vf_storea(p, v) _mm256_store_ps(p, v)
+#define vf_set1(x)      _mm256_set1_ps(x)
+#define vf_zero()       _mm256_setzero_ps()
+#define vf_add(a, b)    _mm256_add_ps(a, b)
+#define vf_sub(a, b)    _mm256_sub_ps(a, b)
+#define vf_mul(a, b)    _mm256_mul_ps(a, b)
+#define vf_div(a, b)    _mm256_div_ps(a, b)
+#define vf_max(a, b)    _mm256_max_ps(a, b)
+#define vf_sqrt(a)      _mm256_sqrt_ps(a)
+#define vf_and(a, b)    _mm256_and_ps(a, b)
+#define vf_andnot(a, b) _mm256_andnot_ps(a, b)
+#define vf_or(a, b)     _mm256_or_ps(a, b)
+#define vf_neq(a, b)    _mm256_cmp_ps(a, b, _CMP_NEQ_UQ)
+#define vf_gt(a, b)     _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define vf_lt(a, b)     _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#if defined(__FMA__)
+#define vf_fma(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define vf_fma(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+static inline float vf_hsum(vf v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+// split x into mantissa in [0.5, 1) and exponent, like frexpf
+static inline vf vf_frexp(vf x, vf *e)
+{
+    __m128i lo = _mm_castps_si128(_mm256_castps256_ps128(x));
+    __m128i hi = _mm_castps_si128(_mm256_extractf128_ps(x, 1));
+    __m128i mask = _mm_set1_epi32(0x807fffff), half = _mm_set1_epi32(0x3f000000);
+    __m128i bias = _mm_set1_epi32(126);
+    __m128i elo = _mm_sub_epi32(_mm_srli_epi32(lo, 23), bias);
+    __m128i ehi = _mm_sub_epi32(_mm_srli_epi32(hi, 23), bias);
+
+    *e = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_cvtepi32_ps(elo)), _mm_cvtepi32_ps(ehi), 1);
+    lo = _mm_or_si128(_mm_and_si128(lo, mask), half);
+    hi = _mm_or_si128(_mm_and_si128(hi, mask), half);
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_castsi128_ps(lo)), _mm_castsi128_ps(hi), 1);
+}
+
+#elif defined(__SSE2__)
+
+typedef __m128 vf;
+#define VF_W 4
+#define vf_load(p)      _mm_loadu_ps(p)
+#define vf_loada(p)     _mm_load_ps(p)
+#define vf_storea(p, v) _mm_store_ps(p, v)
+#define vf_set1(x)      _mm_set1_ps(x)
+#define vf_zero()       _mm_setzero_ps()
+#define vf_add(a, b)    _mm_add_ps(a, b)
+#define vf_sub(a, b)    _mm_sub_ps(a, b)
+#define vf_mul(a, b)    _mm_mul_ps(a, b)
+#define vf_div(a, b)    _mm_div_ps(a, b)
+#define vf_max(a, b)    _mm_max_ps(a, b)
+#define vf_sqrt(a)      _mm_sqrt_ps(a)
+#define vf_and(a, b)    _mm_and_ps(a, b)
+#define vf_andnot(a, b) _mm_andnot_ps(a, b)
+#define vf_or(a, b)     _mm_or_ps(a, b)
+#define vf_neq(a, b)    _mm_cmpneq_ps(a, b)
+#define vf_gt(a, b)     _mm_cmpgt_ps(a, b)
+#define vf_lt(a, b)     _mm_cmplt_ps(a, b)
+#if defined(__FMA__)
+#define vf_fma(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+#define vf_fma(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
+
+static inline float vf_hsum(vf s)
+{
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline vf vf_frexp(vf x, vf *e)
+{
+    __m128i i = _mm_castps_si128(x);
+
+    *e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(i, 23), _mm_set1_epi32(126)));
+    i = _mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x807fffff)), _mm_set1_epi32(0x3f000000));
+    return _mm_castsi128_ps(i);
+}
+
+#else
+
+typedef float vf;
+#define VF_W 1
+#define vf_load(p)      (*(p))
+#define vf_loada(p)     (*(p))
+#define vf_storea(p, v) (*(p) = (v))
+#define vf_set1(x)      (x)
+#define vf_zero()       0.0f
+#define vf_add(a, b)    ((a) + (b))
+#define vf_sub(a, b)    ((a) - (b))
+#define vf_mul(a, b)    ((a) * (b))
+#define vf_div(a, b)    ((a) / (b))
+#define vf_max(a, b)    fmaxf(a, b)
+#define vf_sqrt(a)      sqrtf(a)
+#define vf_hsum(a)      (a)
+
+static inline float vf_mask(int c)
+{
+    unsigned int u = c ? 0xffffffffu : 0;
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline float vf_bits(float a, float b, int op)
+{
+    unsigned int x, y;
+
+    memcpy(&x, &a, sizeof(x));
+    memcpy(&y, &b, sizeof(y));
+    x = op == 0 ? (x & y) : op == 1 ? (~x & y) : (x | y);
+    memcpy(&a, &x, sizeof(a));
+    return a;
+}
+
+#define vf_and(a, b)    vf_bits(a, b, 0)
+#define vf_andnot(a, b) vf_bits(a, b, 1)
+#define vf_or(a, b)     vf_bits(a, b, 2)
+#define vf_neq(a, b)    vf_mask((a) != (b))
+#define vf_gt(a, b)     vf_mask((a) > (b))
+#define vf_lt(a, b)     vf_mask((a) < (b))
+#define vf_fma(a, b, c) ((a)*(b) + (c))
+
+static inline vf vf_frexp(vf x, vf *e)
+{
+    int ei;
+
+    x = frexpf(x, &ei);
+    *e = ei;
+    return x;
+}
+
+#endif
+
+// natural log of positive normal floats, cephes logf, ~1e-7 relative error
+static inline vf vf_log(vf x)
+{
+    vf e, m, z, y, small, one = vf_set1(1.0f);
+
+    m = vf_frexp(x, &e);
+
+    // m in [0.5, 1), fold to [sqrt(0.5), sqrt(2)) around 1
+    small = vf_lt(m, vf_set1(0.707106781186547524f));
+    e = vf_sub(e, vf_and(small, one));
+    m = vf_sub(vf_add(m, vf_and(small, m)), one);
+
+    z = vf_mul(m, m);
+    y = vf_set1(7.0376836292e-2f);
+    y = vf_add(vf_mul(y, m), vf_set1(-1.1514610310e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(1.1676998740e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(-1.2420140846e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(1.4249322787e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(-1.6668057665e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(2.0000714765e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(-2.4999993993e-1f));
+    y = vf_add(vf_mul(y, m), vf_set1(3.3333331174e-1f));
+    y = vf_mul(vf_mul(y, m), z);
+
+    y = vf_add(y, vf_mul(e, vf_set1(-2.12194440e-4f)));
+    y = vf_sub(y, vf_mul(z, vf_set1(0.5f)));
+    m = vf_add(m, y);
+    return vf_add(m, vf_mul(e, vf_set1(0.693359375f)));
+}
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Stats registry, dump and query socket, see stats.h.
+ *
+ * Query a running detector with e.g. "nc -U /tmp/hbtad.sock"; the dump is
+ * written to the connection and it is closed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+#include "queue.h"
+
+#ifndef HBTAD_NO_STATS
+
+static const char *counter_names[NUM_STATS] = {
+    "packets", "invalid_ip", "invalid_tcp", "oversized", "windows", "kmeans_iters",
+    "dropped", "truncated"
+};
+
+static const char *stage_names[NUM_STAGES] = {
+    "parse", "histogram", "window", "cluster", "classify", "replay"
+};
+
+__thread struct stats_local *stats_tls;
+
+static struct stats_local *stats_head;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+double stats_ns_per_tick;
+
+static pthread_t stats_thread;
+static volatile int stats_running;
+static int stats_fd = -1;
+static int stats_interval;
+static char stats_path[108];
+
+// blocks are never freed, counts from exited threads stay in the totals
+struct stats_local *stats_register(void)
+{
+    struct stats_local *s = calloc(1, sizeof(*s));
+
+    if (!s)
+    {
+        fprintf(stderr, "ERROR! stats: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    s->next = stats_head;
+    __atomic_store_n(&stats_head, s, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stats_lock);
+
+    stats_tls = s;
+
+    return s;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// work out how long a stats_now() tick is, 10ms of spinning
+static void stats_calibrate(void)
+{
+    double t0, t1;
+    uint64_t c0, c1;
+
+    if (stats_ns_per_tick > 0)
+        return;
+
+    t0 = now_ns();
+    c0 = stats_now();
+    do {
+        t1 = now_ns();
+    } while (t1 - t0 < 10e6);
+    c1 = stats_now();
+
+    stats_ns_per_tick = (c1 > c0) ? (t1 - t0)/(c1 - c0) : 1.0;
+}
+
+static uint64_t lat_lower(int b)
+{
+    int e;
+
+    if (b < LAT_SUB)
+        return b;
+
+    e = b/LAT_SUB + LAT_SUB_BITS - 1;
+    return (uint64_t)(LAT_SUB + b % LAT_SUB) << (e - LAT_SUB_BITS);
+}
+
+// value at the given quantile, in ns
+static double lat_quantile(const uint64_t *lat, uint64_t total, double q)
+{
+    uint64_t want = (uint64_t)(q*total);
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < LAT_BUCKETS; b++)
+    {
+        seen += lat[b];
+        if (seen > want)
+            return lat_lower(b)*stats_ns_per_tick;
+    }
+
+    return 0;
+}
+
+static double lat_max(const uint64_t *lat)
+{
+    int b;
+
+    for (b = LAT_BUCKETS - 1; b >= 0; b--)
+        if (lat[b])
+            return lat_lower(b)*stats_ns_per_tick;
+
+    return 0;
+}
+
+void stats_dump(FILE *fp)
+{
+    static uint64_t lat[LAT_BUCKETS];
+    uint64_t counters[NUM_STATS];
+    uint64_t total, sum;
+    struct stats_local *s;
+    int i, b;
+
+    stats_calibrate();
+
+    memset(counters, 0, sizeof(counters));
+    for (s = __atomic_load_n(&stats_head, __ATOMIC_ACQUIRE); s; s = s->next)
+        for (i = 0; i < NUM_STATS; i++)
+            counters[i] += __atomic_load_n(&s->counters[i], __ATOMIC_RELAXED);
+
+    fprintf(fp, "stats:");
+    for (i = 0; i < NUM_STATS; i++)
+        fprintf(fp, " %s %llu", counter_names[i], (unsigned long long)counters[i]);
+    fprintf(fp, "\n");
+
+    fprintf(fp, "%-10s %12s %10s %10s %10s %10s %10s\n",
+            "stage", "count", "mean_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+
+    // only one dumper at a time, lat is shared scratch
+    pthread_mutex_lock(&stats_lock);
+    for (i = 0; i < NUM_STAGES; i++)
+    {
+        memset(lat, 0, sizeof(lat));
+        for (s = stats_head; s; s = s->next)
+            for (b = 0; b < LAT_BUCKETS; b++)
+                lat[b] += __atomic_load_n(&s->lat[i][b], __ATOMIC_RELAXED);
+
+        total = 0;
+        sum = 0;
+        for (b = 0; b < LAT_BUCKETS; b++)
+        {
+            total += lat[b];
+            sum += lat[b]*lat_lower(b);
+        }
+
+        if (total == 0)
+            continue;
+
+        fprintf(fp, "%-10s %12llu %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                stage_names[i], (unsigned long long)total,
+                sum*stats_ns_per_tick/total,
+                lat_quantile(lat, total, 0.5),
+                lat_quantile(lat, total, 0.99),
+                lat_quantile(lat, total, 0.999),
+                lat_max(lat));
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    queue_dump(fp);
+}
+
+static void stats_answer(int fd)
+{
+    char *buf = NULL;
+    size_t len = 0, off = 0;
+    ssize_t n;
+    FILE *fp;
+
+    if ((fp = open_memstream(&buf, &len)) == NULL)
+        return;
+
+    stats_dump(fp);
+    fclose(fp);
+
+    while (off < len)
+    {
+        n = write(fd, buf + off, len - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+
+    free(buf);
+}
+
+static void *stats_loop(void *arg)
+{
+    struct pollfd pfd;
+    double next_dump, now;
+    int conn;
+
+    (void)arg;
+
+    next_dump = now_ns() + stats_interval*1e9;
+
+    while (stats_running)
+    {
+        pfd.fd = stats_fd;
+        pfd.events = POLLIN;
+
+        // wake up regularly so stats_stop() doesn't have to wait long
+        if (poll(&pfd, stats_fd >= 0 ? 1 : 0, 250) > 0 && (pfd.revents & POLLIN))
+        {
+            if ((conn = accept(stats_fd, NULL, NULL)) >= 0)
+            {
+                stats_answer(conn);
+                close(conn);
+            }
+        }
+
+        now = now_ns();
+        if (stats_interval > 0 && now >= next_dump)
+        {
+            stats_dump(stderr);
+            next_dump = now + stats_interval*1e9;
+        }
+    }
+
+    return NULL;
+}
+
+int stats_start(const char *sock_path, int interval)
+{
+    struct sockaddr_un addr;
+
+    // calibrating spins for 10 ms, only worth it when stats are asked for
+    if (interval <= 0 && !sock_path)
+        return 0;
+
+    stats_calibrate();
+
+    stats_interval = interval;
+
+    if (sock_path)
+    {
+        if (strlen(sock_path) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "ERROR! stats: socket path too long: %s\n", sock_path);
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, sock_path);
+        unlink(sock_path);
+
+        if ((stats_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || bind(stats_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(stats_fd, 4) < 0)
+        {
+            fprintf(stderr, "ERROR! stats: unable to listen on %s: %s\n",
+                    sock_path, strerror(errno));
+            if (stats_fd >= 0)
+                close(stats_fd);
+            stats_fd = -1;
+            return -1;
+        }
+
+        strcpy(stats_path, sock_path);
+    }
+
+    stats_running = 1;
+    if (pthread_create(&stats_thread, NULL, stats_loop, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR! stats: unable to create stats thread\n");
+        stats_running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void stats_stop(void)
+{
+    if (!stats_running)
+        return;
+
+    stats_running = 0;
+    pthread_join(stats_thread, NULL);
+
+    if (stats_fd >= 0)
+    {
+        close(stats_fd);
+        unlink(stats_path);
+        stats_fd = -1;
+    }
+}
+
+#else
+
+int stats_start(const char *sock_path, int interval)
+{
+    (void)sock_path;
+    (void)interval;
+    return 0;
+}
+
+void stats_stop(void)
+{
+}
+
+void stats_dump(FILE *fp)
+{
+    fprintf(fp, "stats: compiled out (HBTAD_NO_STATS)\n");
+    queue_dump(fp);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Hot path counters and per-stage latency histograms.
+ *
+ * Every thread gets its own block of counters, so updates are plain
+ * stores with no locked instructions.  Readers sum the blocks of all
+ * threads.  Build with -DHBTAD_NO_STATS to compile all of it away.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum stat_counter {
+    STAT_PACKETS,
+    STAT_INVALID_IP,
+    STAT_INVALID_TCP,
+    STAT_OVERSIZED,
+    STAT_WINDOWS,
+    STAT_KMEANS_ITERS,
+    STAT_DROPPED,       // pipeline parse queues full, see pipeline.h
+    STAT_TRUNCATED,     // cut off inside the IP or TCP header
+    NUM_STATS
+};
+
+enum stat_stage {
+    STAGE_PARSE,
+    STAGE_HIST,
+    STAGE_WINDOW,
+    STAGE_CLUSTER,
+    STAGE_CLASSIFY,
+    STAGE_REPLAY,       // paced replay, packet due time to done
+    NUM_STAGES
+};
+
+// log-linear (HDR style) latency buckets, 16 per power of 2, ~6% precision
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1)*LAT_SUB)
+
+// start the periodic dump (every interval seconds, 0 for never) to stderr
+// and the query socket (sock_path, NULL for none)
+int stats_start(const char *sock_path, int interval);
+void stats_stop(void);
+
+// write all counters and latency percentiles to fp
+void stats_dump(FILE *fp);
+
+#ifndef HBTAD_NO_STATS
+
+struct stats_local {
+    uint64_t counters[NUM_STATS];
+    uint64_t lat[NUM_STAGES][LAT_BUCKETS];
+    struct stats_local *next;
+};
+
+extern __thread struct stats_local *stats_tls;
+
+// length of a stats_now() tick, measured by stats_start() when stats are
+// asked for, or else by the first stats_dump(), 0 until then
+extern double stats_ns_per_tick;
+
+struct stats_local *stats_register(void);
+
+static inline struct stats_local *stats_self(void)
+{
+    return stats_tls ? stats_tls : stats_register();
+}
+
+// only the owning thread writes, relaxed stores keep readers tear free
+static inline void stats_add(int c, uint64_t n)
+{
+    uint64_t *p = &stats_self()->counters[c];
+
+    __atomic_store_n(p, *p + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline int lat_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < LAT_SUB)
+        return (int)v;
+
+    e = 63 - __builtin_clzll(v);
+    return (e - LAT_SUB_BITS + 1)*LAT_SUB + (int)((v >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+// record a latency of ticks against stage
+static inline void stats_record(int stage, uint64_t ticks)
+{
+    uint64_t *p = &stats_self()->lat[stage][lat_bucket(ticks)];
+
+    __atomic_store_n(p, *p + 1, __ATOMIC_RELAXED);
+}
+
+// record the time since *t against stage and restart the timer
+static inline void stats_lap(uint64_t *t, int stage)
+{
+    uint64_t now = stats_now();
+
+    stats_record(stage, now - *t);
+    *t = now;
+}
+
+// record a latency measured on another clock, in ns
+static inline void stats_record_ns(int stage, double ns)
+{
+    stats_record(stage, (uint64_t)(stats_ns_per_tick > 0 ? ns/stats_ns_per_tick : ns));
+}
+
+#define STAT_INC(c)             stats_add((c), 1)
+#define STAT_ADD(c, n)          stats_add((c), (n))
+#define STAT_TIMER(t)           uint64_t t
+#define STAT_START(t)           ((t) = stats_now())
+#define STAT_LAP(t, stage)      stats_lap(&(t), (stage))
+#define STAT_RECORD_NS(stage, ns) stats_record_ns((stage), (ns))
+
+#else
+
+#define STAT_INC(c)             ((void)0)
+#define STAT_ADD(c, n)          ((void)0)
+#define STAT_TIMER(t)           int t __attribute__((unused))
+#define STAT_START(t)           ((void)0)
+#define STAT_LAP(t, stage)      ((void)0)
+#define STAT_RECORD_NS(stage, ns) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * Persistent window history, see store.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hbtad.h"
+#include "store.h"
+
+_Static_assert(sizeof(struct store_header) == 64, "store header must stay 64 bytes");
+
+static void seg_path(const struct store *s, int seq, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s/seg-%08d.hws", s->dir, seq);
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    return ((const struct store_seg *)a)->seq - ((const struct store_seg *)b)->seq;
+}
+
+static struct store_seg *store_seg_new(struct store *s)
+{
+    if (s->nsegs == s->segs_cap)
+    {
+        s->segs_cap = s->segs_cap ? 2*s->segs_cap : 16;
+        if ((s->segs = realloc(s->segs, s->segs_cap*sizeof(*s->segs))) == NULL)
+        {
+            fprintf(stderr, "ERROR! store: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(&s->segs[s->nsegs], 0, sizeof(*s->segs));
+    return &s->segs[s->nsegs++];
+}
+
+static int header_ok(const struct store *s, const struct store_header *h, const char *path,
+                     off_t size)
+{
+    if (h->magic != STORE_MAGIC || h->version != STORE_VERSION)
+    {
+        fprintf(stderr, "ERROR! store: %s is not a window segment\n", path);
+        return 0;
+    }
+
+    if (h->vec_len != (uint32_t)s->vec_len || h->layout != s->layout)
+    {
+        fprintf(stderr, "ERROR! store: %s holds vectors of a different layout "
+                "(binning changed?)\n", path);
+        return 0;
+    }
+
+    // store_query() maps count records, they have to be there
+    if (h->count > s->capacity
+        || (uint64_t)size < sizeof(*h) + (uint64_t)h->count*s->rec_size)
+    {
+        fprintf(stderr, "ERROR! store: %s is damaged, %u windows don't fit\n",
+                path, (unsigned int)h->count);
+        return 0;
+    }
+
+    return 1;
+}
+
+int store_open(struct store *s, const char *dir, int vec_len, uint64_t layout)
+{
+    struct store_header h;
+    struct store_seg *seg;
+    struct dirent *de;
+    struct stat st;
+    char path[4096];
+    DIR *d;
+    int fd, seq;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->vec_len = vec_len;
+    s->layout = layout;
+    s->rec_size = (sizeof(int64_t) + vec_len*sizeof(int) + 7) & ~(size_t)7;
+    s->capacity = (STORE_SEG_BYTES - sizeof(h))/s->rec_size;
+    if (s->capacity < 1)
+        s->capacity = 1;
+
+    if ((s->rec = calloc(1, s->rec_size)) == NULL)
+    {
+        fprintf(stderr, "ERROR! store: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "ERROR! store: unable to create %s: %s\n", dir, strerror(errno));
+        store_close(s);
+        return -1;
+    }
+
+    if ((s->dir = strdup(dir)) == NULL || (d = opendir(dir)) == NULL)
+    {
+        fprintf(stderr, "ERROR! store: unable to open %s: %s\n", dir, strerror(errno));
+        store_close(s);
+        return -1;
+    }
+
+    // the index is just the headers of all segments
+    while ((de = readdir(d)) != NULL)
+    {
+        if (sscanf(de->d_name, "seg-%8d.hws", &seq) != 1)
+            continue;
+
+        seg_path(s, seq, path, sizeof(path));
+        if ((fd = open(path, O_RDONLY)) < 0
+            || fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != sizeof(h))
+        {
+            fprintf(stderr, "ERROR! store: unable to read %s\n", path);
+            if (fd >= 0)
+                close(fd);
+            closedir(d);
+            store_close(s);
+            return -1;
+        }
+        close(fd);
+
+        if (!header_ok(s, &h, path, st.st_size))
+        {
+            closedir(d);
+            store_close(s);
+            return -1;
+        }
+
+        seg = store_seg_new(s);
+        seg->seq = seq;
+        seg->count = h.count;
+        seg->first = h.first;
+        seg->last = h.last;
+    }
+    closedir(d);
+
+    if (s->nsegs > 1)
+        qsort(s->segs, s->nsegs, sizeof(*s->segs), cmp_seq);
+
+    return 0;
+}
+
+void store_close(struct store *s)
+{
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+    free(s->segs);
+    free(s->dir);
+    free(s->rec);
+    s->segs = NULL;
+    s->dir = NULL;
+    s->rec = NULL;
+    s->nsegs = s->segs_cap = 0;
+}
+
+// make the segment a window starting at start goes into open for appends
+static int store_seg_for(struct store *s, long start)
+{
+    struct store_seg *last = s->nsegs ? &s->segs[s->nsegs - 1] : NULL;
+    char path[4096];
+    int seq;
+
+    if (s->fd >= 0 && s->head.count < s->head.capacity && start >= s->head.last)
+        return 0;
+
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+
+    // carry on with the newest segment if the window fits on its end
+    if (last && last->count < s->capacity && (last->count == 0 || start >= last->last))
+    {
+        seg_path(s, last->seq, path, sizeof(path));
+        if ((s->fd = open(path, O_RDWR)) < 0
+            || pread(s->fd, &s->head, sizeof(s->head), 0) != sizeof(s->head))
+            goto fail;
+
+        return 0;
+    }
+
+    seq = last ? last->seq + 1 : 0;
+    seg_path(s, seq, path, sizeof(path));
+
+    memset(&s->head, 0, sizeof(s->head));
+    s->head.magic = STORE_MAGIC;
+    s->head.version = STORE_VERSION;
+    s->head.layout = s->layout;
+    s->head.vec_len = s->vec_len;
+    s->head.capacity = s->capacity;
+
+    // the file is sized up front so readers can map it whole
+    if ((s->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0
+        || ftruncate(s->fd, sizeof(s->head) + (off_t)s->capacity*s->rec_size) != 0
+        || pwrite(s->fd, &s->head, sizeof(s->head), 0) != sizeof(s->head))
+        goto fail;
+
+    store_seg_new(s)->seq = seq;
+
+    return 0;
+
+fail:
+    fprintf(stderr, "ERROR! store: unable to write %s: %s\n", path, strerror(errno));
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+    return -1;
+}
+
+int store_append(struct store *s, long start, const int *vec)
+{
+    struct store_seg *seg;
+    int64_t t = start;
+    off_t off;
+
+    if (store_seg_for(s, start) != 0)
+        return -1;
+
+    memcpy(s->rec, &t, sizeof(t));
+    memcpy(s->rec + sizeof(t), vec, s->vec_len*sizeof(int));
+
+    // record first, then the header that makes it visible
+    off = sizeof(s->head) + (off_t)s->head.count*s->rec_size;
+    if (pwrite(s->fd, s->rec, s->rec_size, off) != (ssize_t)s->rec_size)
+    {
+        fprintf(stderr, "ERROR! store: write failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (s->head.count == 0)
+        s->head.first = start;
+    s->head.last = start;
+    s->head.count++;
+
+    if (pwrite(s->fd, &s->head, sizeof(s->head), 0) != sizeof(s->head))
+    {
+        fprintf(stderr, "ERROR! store: write failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    seg = &s->segs[s->nsegs - 1];
+    seg->count = s->head.count;
+    seg->first = s->head.first;
+    seg->last = s->head.last;
+
+    return 0;
+}
+
+// a window found by store_query(), sorted by start and then by where it
+// was found, so windows with the same start keep the segment order
+struct found {
+    long start;
+    int *vec;
+    int at;
+};
+
+static int cmp_found(const void *a, const void *b)
+{
+    const struct found *x = a, *y = b;
+
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->at - y->at;
+}
+
+// put the last n windows of ws in start order
+static int sort_tail(struct window_set *ws, int n)
+{
+    struct found *f;
+    int i, base = ws->n - n;
+
+    if ((f = malloc((size_t)n*sizeof(*f))) == NULL)
+    {
+        fprintf(stderr, "ERROR! store: out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        f[i].start = ws->start[base + i];
+        f[i].vec = ws->vecs[base + i];
+        f[i].at = i;
+    }
+    qsort(f, n, sizeof(*f), cmp_found);
+    for (i = 0; i < n; i++)
+    {
+        ws->start[base + i] = f[i].start;
+        ws->vecs[base + i] = f[i].vec;
+    }
+
+    free(f);
+    return 0;
+}
+
+static int64_t rec_start(const char *base, size_t rec_size, uint32_t i)
+{
+    int64_t t;
+
+    memcpy(&t, base + (size_t)i*rec_size, sizeof(t));
+    return t;
+}
+
+int store_query(struct store *s, long from, long to, struct window_set *out)
+{
+    const struct store_seg *seg;
+    char path[4096];
+    char *map, *recs;
+    size_t len;
+    uint32_t lo, hi, mid;
+    int i, fd, added = 0, sorted = 1;
+    int64_t t, prev = INT64_MIN;
+    int *vec;
+
+    for (i = 0; i < s->nsegs; i++)
+    {
+        seg = &s->segs[i];
+        if (seg->count == 0 || seg->last < from || seg->first > to)
+            continue;
+
+        seg_path(s, seg->seq, path, sizeof(path));
+        len = sizeof(struct store_header) + (size_t)seg->count*s->rec_size;
+        if ((fd = open(path, O_RDONLY)) < 0
+            || (map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            fprintf(stderr, "ERROR! store: unable to map %s: %s\n", path, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+        madvise(map, len, MADV_SEQUENTIAL);
+
+        recs = map + sizeof(struct store_header);
+
+        // first record starting at or after from
+        lo = 0;
+        hi = seg->count;
+        while (lo < hi)
+        {
+            mid = lo + (hi - lo)/2;
+            if (rec_start(recs, s->rec_size, mid) < from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for (; lo < seg->count; lo++)
+        {
+            t = rec_start(recs, s->rec_size, lo);
+            if (t > to)
+                break;
+
+            if ((vec = window_set_add(out, t)) == NULL)
+            {
+                fprintf(stderr, "ERROR! store: out of memory\n");
+                munmap(map, len);
+                return -1;
+            }
+            memcpy(vec, recs + (size_t)lo*s->rec_size + sizeof(int64_t), s->vec_len*sizeof(int));
+            added++;
+
+            sorted &= t >= prev;
+            prev = t;
+        }
+
+        munmap(map, len);
+    }
+
+    // segments can overlap in time, when older windows were appended later
+    if (!sorted && sort_tail(out, added) != 0)
+        return -1;
+
+    return added;
+}
+
+long store_last(const struct store *s)
+{
+    long last = -1;
+    int i;
+
+    for (i = 0; i < s->nsegs; i++)
+        if (s->segs[i].count && s->segs[i].last > last)
+            last = s->segs[i].last;
+
+    return last;
+}
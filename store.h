@@ -0,0 +1,83 @@
+#ifndef STORE_H
+#define STORE_H
+
+/*
+ * Persistent window history.
+ *
+ * A store is a directory of fixed size segment files, seg-00000000.hws,
+ * seg-00000001.hws, ...  Each segment is a header followed by records of
+ * (window start, feature vector) and is only ever appended to.  Records
+ * in a segment are in start time order; a window older than the last one
+ * written opens a new segment.  The headers keep the first and last start
+ * of every segment, which together are the time index: a query maps only
+ * the segments that overlap the range and binary searches into them.
+ * Segments may overlap in time, when older windows are appended later, so
+ * a query that finds its windows out of order sorts them.
+ *
+ * All vectors in a store share one layout (length and binning), stores
+ * made with a different HBTAD_SIZE_BINS / HBTAD_PORT_BINS are refused.
+ */
+
+#include <stdint.h>
+
+#include "hbtad.h"
+
+// segment size on disk, the record count follows from the vector length
+#ifndef STORE_SEG_BYTES
+#define STORE_SEG_BYTES (64 << 20)
+#endif
+
+#define STORE_MAGIC 0x57544248     // "HBTW"
+#define STORE_VERSION 1
+
+struct store_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t layout;        // feature_layout() of the vectors
+    uint32_t vec_len;
+    uint32_t capacity;      // records the segment has room for
+    uint32_t count;         // records written, updated after each record
+    uint32_t pad;
+    int64_t first;          // start of the first and last record
+    int64_t last;
+    uint8_t reserved[16];
+};
+
+struct store_seg {
+    int seq;
+    uint32_t count;
+    int64_t first;
+    int64_t last;
+};
+
+struct store {
+    char *dir;
+    int vec_len;
+    uint64_t layout;
+    size_t rec_size;
+    uint32_t capacity;
+
+    struct store_seg *segs;     // by seq, the last one is appended to
+    int nsegs;
+    int segs_cap;
+
+    int fd;                     // open segment for appends, -1 if none
+    struct store_header head;
+    char *rec;                  // record being appended
+};
+
+// open or create the store in dir for vectors of vec_len ints
+int store_open(struct store *s, const char *dir, int vec_len, uint64_t layout);
+void store_close(struct store *s);
+
+// append one window, starts should mostly increase
+int store_append(struct store *s, long start, const int *vec);
+
+// add every stored window with from <= start <= to to out, in start order
+// across segments, returns the number added or -1
+int store_query(struct store *s, long from, long to, struct window_set *out);
+
+// start of the newest window in the store, -1 if empty
+long store_last(const struct store *s);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Tenant table, see tenant.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tenant.h"
+#include "hist.h"
+
+static struct tenant default_tenant = { "default", { 0 } };
+
+struct tenant *tenants = &default_tenant;
+int num_tenants = 1;
+struct lpm tenant_lpm;
+
+int tenants_load(const char *path)
+{
+    char (*names)[LPM_NAME_LEN];
+    int i, n;
+
+    // tenant 0 is the default one, the file's tenants start at 1
+    if ((n = lpm_read(&tenant_lpm, path, 1, TENANT_MAX - 1, &names)) < 0)
+        return -1;
+
+    if (hist_set_tenants(n + 1) != 0)
+    {
+        free(names);
+        lpm_free(&tenant_lpm);
+        return -1;
+    }
+
+    if ((tenants = calloc(n + 1, sizeof(*tenants))) == NULL)
+    {
+        fprintf(stderr, "ERROR! tenants: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    tenants[0] = default_tenant;
+    for (i = 0; i < n; i++)
+        memcpy(tenants[i + 1].name, names[i], sizeof(names[i]));
+    free(names);
+
+    num_tenants = n + 1;
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef TENANT_H
+#define TENANT_H
+
+/*
+ * Tenants, independently baselined subnets sharing one capture.
+ *
+ * Every packet goes to the tenant whose prefixes match its destination,
+ * or failing that its source, longest prefix first.  Everything else goes
+ * to tenant 0, "default", which is all traffic when no tenants are
+ * configured.  Each tenant gets its own histograms, windows, store and
+ * model; memory per tenant is a fixed histogram set per capture thread,
+ * allocated on its first packet.
+ *
+ * The tenants file has one tenant per line, a name followed by its
+ * prefixes, '#' starts a comment:
+ *
+ *     acme     10.1.0.0/16 192.0.2.0/24
+ *     globex   10.2.0.0/16
+ */
+
+#include "hbtad.h"
+#include "lpm.h"
+
+#define TENANT_NAME_LEN LPM_NAME_LEN
+#define TENANT_MAX LPM_MAX_VALUE
+
+struct tenant {
+    char name[TENANT_NAME_LEN];
+    struct window_set windows;
+};
+
+extern struct tenant *tenants;
+extern int num_tenants;
+extern struct lpm tenant_lpm;
+
+// read the tenants file, 0 on success
+int tenants_load(const char *path);
+
+static inline int tenant_of(const struct pkt_features *pf)
+{
+    int t;
+
+    if (num_tenants == 1)
+        return 0;
+
+    t = lpm_lookup(&tenant_lpm, pf->daddr);
+    return t ? t : lpm_lookup(&tenant_lpm, pf->saddr);
+}
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * Fuzzing harness for the packet parser and the capture file readers.
+ *
+ * Two targets, each an LLVMFuzzerTestOneInput():
+ *
+ *   parse.c    one packet from its IP header on, through parse_count()
+ *              and hist_add(), and as a frame through parse_packet()
+ *   replay.c   one capture file, pcap, pcapng or compressed, through
+ *              source_next(), then parsed and counted packet by packet
+ *
+ * Built with clang -fsanitize=fuzzer they run under libFuzzer, which
+ * brings its own main().  Everything else links this file as the main()
+ * instead:
+ *
+ *   - afl-clang-fast builds run persistent, one process for many inputs,
+ *     reading each from stdin.  Plain afl-gcc builds, or any build given
+ *     no files, read a single input from stdin.
+ *
+ *   - Given files or directories, every file is run once, which replays a
+ *     corpus or a crash under a debugger or plain gcc -fsanitize builds.
+ *
+ *   - -runs=N then runs N more inputs made by flipping, overwriting and
+ *     cutting short the given ones, a cheap smoke test with no fuzzer
+ *     installed.  -seed=N picks the mutations, 1 if not given.
+ *
+ * -runs, -seed and -close_fd_mask mean what they do to libFuzzer, so the
+ * same command line works with either main, other -flag=value options are
+ * libFuzzer's and are ignored here.  See the Makefile's fuzz targets.
+ *
+ * Seed inputs are in corpus/parse and corpus/replay.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// largest input read, a little over the largest seed capture
+#define FUZZ_MAX_LEN (1 << 20)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+struct input {
+    uint8_t *data;
+    size_t size;
+};
+
+static struct input *inputs;
+static int num_inputs, cap_inputs;
+
+static uint64_t rng;
+
+static uint64_t next_rand(void)
+{
+    // xorshift64*
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+static void add_input(uint8_t *data, size_t size)
+{
+    if (num_inputs == cap_inputs)
+    {
+        cap_inputs = cap_inputs ? 2*cap_inputs : 64;
+        if ((inputs = realloc(inputs, cap_inputs*sizeof(*inputs))) == NULL)
+        {
+            fprintf(stderr, "ERROR! fuzz: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    inputs[num_inputs].data = data;
+    inputs[num_inputs].size = size;
+    num_inputs++;
+}
+
+// all of fp, at most FUZZ_MAX_LEN bytes
+static uint8_t *read_all(FILE *fp, size_t *size)
+{
+    uint8_t *buf;
+
+    if ((buf = malloc(FUZZ_MAX_LEN)) == NULL)
+    {
+        fprintf(stderr, "ERROR! fuzz: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    *size = fread(buf, 1, FUZZ_MAX_LEN, fp);
+
+    return buf;
+}
+
+static int load(const char *path)
+{
+    char sub[4096];
+    struct dirent *de;
+    struct stat st;
+    uint8_t *buf;
+    size_t size;
+    DIR *dir;
+    FILE *fp;
+
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "ERROR! fuzz: unable to open %s\n", path);
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        if ((dir = opendir(path)) == NULL)
+        {
+            fprintf(stderr, "ERROR! fuzz: unable to open %s\n", path);
+            return -1;
+        }
+        while ((de = readdir(dir)) != NULL)
+        {
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+            if (load(sub) != 0)
+            {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        return 0;
+    }
+
+    if ((fp = fopen(path, "rb")) == NULL)
+    {
+        fprintf(stderr, "ERROR! fuzz: unable to open %s\n", path);
+        return -1;
+    }
+    buf = read_all(fp, &size);
+    add_input(buf, size);
+    fclose(fp);
+
+    return 0;
+}
+
+// a few random edits of in, into out, returns the new size
+static size_t mutate(const struct input *in, uint8_t *out)
+{
+    static const uint8_t special[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+    size_t size = in->size, at;
+    int n = 1 + next_rand() % 8;
+
+    memcpy(out, in->data, size);
+
+    while (n-- > 0 && size > 0)
+    {
+        at = next_rand() % size;
+        switch (next_rand() % 4)
+        {
+            case 0:
+                out[at] ^= 1 << (next_rand() % 8);
+                break;
+            case 1:
+                out[at] = special[next_rand() % sizeof(special)];
+                break;
+            case 2:
+                out[at] = (uint8_t)next_rand();
+                break;
+            case 3:
+                size = at;
+                break;
+        }
+    }
+
+    return size;
+}
+
+// run one copy of data, sized exactly, so overreads of the input show up
+static void run(const uint8_t *data, size_t size)
+{
+    uint8_t *copy = malloc(size ? size : 1);
+
+    if (!copy)
+    {
+        fprintf(stderr, "ERROR! fuzz: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, data, size);
+    LLVMFuzzerTestOneInput(copy, size);
+    free(copy);
+}
+
+int main(int argc, char **argv)
+{
+    long runs = 0, i;
+    uint8_t *buf;
+    size_t size;
+    int a, mask = 0, fd;
+
+    rng = 1;
+
+    for (a = 1; a < argc; a++)
+    {
+        if (strncmp(argv[a], "-runs=", 6) == 0)
+            runs = atol(argv[a] + 6);
+        else if (strncmp(argv[a], "-seed=", 6) == 0)
+            rng = strtoull(argv[a] + 6, NULL, 10);
+        else if (strncmp(argv[a], "-close_fd_mask=", 15) == 0)
+            mask = atoi(argv[a] + 15);
+        else if (argv[a][0] == '-' && strchr(argv[a], '='))
+            continue;
+        else if (load(argv[a]) != 0)
+            return EXIT_FAILURE;
+    }
+    if (rng == 0)
+        rng = 1;
+
+    if ((mask & 3) && (fd = open("/dev/null", O_WRONLY)) >= 0)
+    {
+        if (mask & 1)
+            dup2(fd, 1);
+        if (mask & 2)
+            dup2(fd, 2);
+        close(fd);
+    }
+
+    if (num_inputs == 0)
+    {
+#ifdef __AFL_LOOP
+        while (__AFL_LOOP(10000))
+        {
+            clearerr(stdin);
+            buf = read_all(stdin, &size);
+            run(buf, size);
+            free(buf);
+        }
+#else
+        buf = read_all(stdin, &size);
+        run(buf, size);
+        free(buf);
+#endif
+        return 0;
+    }
+
+    for (a = 0; a < num_inputs; a++)
+        run(inputs[a].data, inputs[a].size);
+
+    if ((buf = malloc(FUZZ_MAX_LEN)) == NULL)
+    {
+        fprintf(stderr, "ERROR! fuzz: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < runs; i++)
+    {
+        size = mutate(&inputs[next_rand() % num_inputs], buf);
+        run(buf, size);
+    }
+    free(buf);
+
+    for (a = 0; a < num_inputs; a++)
+        free(inputs[a].data);
+    free(inputs);
+
+    fprintf(stderr, "%d inputs, %ld mutated runs\n", num_inputs, runs);
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Fuzz target for the packet parser, see driver.c.
+ *
+ * The input is a packet from its IP header on.  It is copied into a
+ * buffer of exactly its size, so a sanitizer build catches parse_ip()
+ * reading a single byte past what was captured, and then goes through
+ * parse_count() and hist_add() as got_ip() would put it.  The same bytes
+ * are then parsed once more as a whole ethernet frame by parse_packet(),
+ * which covers frames too short for the link header.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hbtad.h"
+#include "hist.h"
+
+// clear the histograms every so often, the counters are plain ints
+#define FUZZ_RESET_EVERY (1 << 20)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static long runs;
+    struct pcap_pkthdr h = { { 0 } };
+    struct pkt_features pf;
+    u_char *pkt;
+
+    if (size > SNAP_LEN)
+        return 0;
+
+    // malloc(0) may well return NULL, one byte is still out of bounds
+    if ((pkt = malloc(size ? size : 1)) == NULL)
+        abort();
+    memcpy(pkt, data, size);
+
+    parse_count(pkt, (int)size, &pf);
+    hist_add(&pf);
+
+    h.caplen = h.len = size;
+    parse_packet(&h, pkt, &pf);
+
+    free(pkt);
+
+    if (++runs % FUZZ_RESET_EVERY == 0)
+        hist_reset();
+
+    return 0;
+}
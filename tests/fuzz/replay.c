@@ -0,0 +1,71 @@
+/*
+ * Fuzz target for the capture file readers, see driver.c.
+ *
+ * The input is a whole capture file: classic pcap in either byte order,
+ * pcapng, or either of them compressed.  It goes into a memfd and is read
+ * back through source_open() and source_next(), the path replay() takes,
+ * so the native pcapng reader is run straight off its mapping.  Every
+ * packet then has to stay inside what its header says was captured and
+ * is parsed and counted out of a buffer of exactly that size.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hbtad.h"
+#include "hist.h"
+#include "replay.h"
+
+// packets counted between clearing the histograms
+#define FUZZ_RESET_EVERY (1 << 20)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static long packets;
+    struct pcap_pkthdr h;
+    struct pkt_features pf;
+    struct source *s;
+    const u_char *l3;
+    u_char *pkt;
+    char path[64];
+    int fd, len;
+
+    if ((fd = memfd_create("fuzz", 0)) < 0)
+        abort();
+    if (write(fd, data, size) != (ssize_t)size)
+        abort();
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    if ((s = source_open(path)) != NULL)
+    {
+        while (source_next(s, &h, &l3, &len) == 1)
+        {
+            if (len > (int)h.caplen)
+                abort();
+
+            if ((pkt = malloc(len > 0 ? len : 1)) == NULL)
+                abort();
+            if (len > 0)
+                memcpy(pkt, l3, len);
+
+            parse_count(pkt, len, &pf);
+            hist_add(&pf);
+            free(pkt);
+
+            if (++packets % FUZZ_RESET_EVERY == 0)
+                hist_reset();
+        }
+        source_close(s);
+    }
+
+    close(fd);
+
+    return 0;
+}
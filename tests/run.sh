@@ -0,0 +1,145 @@
+#!/bin/sh
+#
+# Golden output regression tests.
+#
+#     tests/run.sh [-u] [path/to/hbtad]
+#
+# Runs hbtad in deterministic mode (-D) over the small captures in data/
+# and compares everything it prints to golden/<case>.out: the histogram
+# counts, per packet alerts, cluster sizes and each window's cluster and
+# distance.  The store and model cases also compare checksums of the
+# stored window vectors and the saved centroids.  Any difference at all
+# fails, so a change that should not alter results (a faster kernel, more
+# threads) can be checked bit for bit.
+#
+# -u writes the current output as the new golden files instead, for when a
+# change of results is intended.  Review the diff before committing it.
+#
+# The golden files come from a plain make build.  Flags that change float
+# rounding, such as -march=native contracting into FMA, can move the last
+# printed digit of a distance, and the tests catch that too.
+#
+# The captures were made with hbtad_bench:
+#
+#     hbtad_bench -n 600 -t 5 -s 1 -W 4 -k 2 -r 1 -m 0.02 -w tap1.pcap
+#     hbtad_bench -n 600 -t 5 -s 2 -W 4 -k 2 -r 1 -m 0.02 -v 0.1 -w tap2.pcap
+#     gzip -kn tap2.pcap
+#
+# A tenth of tap2's frames carry an 802.1Q tag.
+
+update=0
+if [ "${1:-}" = "-u" ]; then
+    update=1
+    shift
+fi
+
+bin=${1:-hbtad}
+case $bin in
+    /*) ;;
+    *) bin=$PWD/$bin ;;
+esac
+
+cd "$(dirname "$0")" || exit 1
+tests=$PWD
+data=$tests/data
+golden=$tests/golden
+
+if [ ! -x "$bin" ]; then
+    echo "usage: $0 [-u] path/to/hbtad" >&2
+    exit 2
+fi
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+passed=0
+failed=0
+
+# compare $tmp/<case>.out with golden/<expect>.out, or update the golden
+check()
+{
+    name=$1
+    expect=$2
+
+    if [ $update = 1 ]; then
+        if [ "$name" = "$expect" ]; then
+            cp "$tmp/$name.out" "$golden/$expect.out"
+        elif ! cmp -s "$tmp/$name.out" "$golden/$expect.out"; then
+            echo "warning: $name no longer matches $expect" >&2
+        fi
+        return
+    fi
+
+    if cmp -s "$tmp/$name.out" "$golden/$expect.out"; then
+        passed=$((passed + 1))
+        echo "ok      $name"
+    else
+        failed=$((failed + 1))
+        echo "FAILED  $name"
+        diff -u "$golden/$expect.out" "$tmp/$name.out" | head -20
+    fi
+}
+
+# run <case> <golden> [VAR=value...] -- [hbtad arguments...]
+#
+# from inside $tmp, so relative store and model paths end up there
+run()
+{
+    name=$1
+    expect=$2
+    shift 2
+
+    vars=
+    while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+        vars="$vars $1"
+        shift
+    done
+    shift
+
+    if ! (cd "$tmp" && env $vars "$bin" -D "$@") > "$tmp/$name.out" 2> "$tmp/$name.err"; then
+        failed=$((failed + 1))
+        echo "FAILED  $name (exit status)"
+        head -5 "$tmp/$name.err"
+        return
+    fi
+
+    check "$name" "$expect"
+}
+
+# checksums of the files under $tmp/<dir>, as <case>
+sums()
+{
+    name=$1
+    shift
+
+    (cd "$tmp" && find "$@" -type f | LC_ALL=C sort | xargs cksum) > "$tmp/$name.out"
+    check "$name" "$name"
+}
+
+run single          single          -- "$data/tap1.pcap"
+run merged          merged          -- "$data/tap1.pcap" "$data/tap2.pcap"
+run merged_reversed merged          -- "$data/tap2.pcap" "$data/tap1.pcap"
+run gzip            merged          -- "$data/tap1.pcap" "$data/tap2.pcap.gz"
+run pipeline        pipeline        -- -P -p 3 "$data/tap1.pcap" "$data/tap2.pcap"
+run binning         binning         HBTAD_SIZE_BINS=log:32 HBTAD_PORT_BINS=fixed:64 \
+                                    HBTAD_PROJECT=none HBTAD_METRIC=chi2 \
+                                    -- "$data/tap1.pcap" "$data/tap2.pcap"
+run quantile        quantile        HBTAD_SIZE_BINS=quantile:16 HBTAD_PROJECT=random:8 \
+                                    -- "$data/tap1.pcap" "$data/tap2.pcap"
+run tenants         tenants         HBTAD_TENANTS="$data/tenants.txt" \
+                                    HBTAD_ADDR_PREFIXES="$data/prefixes.txt" \
+                                    -- "$data/tap1.pcap" "$data/tap2.pcap"
+run no_windows      no_windows      HBTAD_WINDOW=0 -- "$data/tap1.pcap" "$data/tap2.pcap"
+run store_train     store_train     HBTAD_STORE=store HBTAD_MODEL=model -- -c 300 "$data/tap1.pcap"
+run store_retrain   store_retrain   HBTAD_STORE=store HBTAD_MODEL=model HBTAD_RETRAIN=1 \
+                                    -- "$data/tap1.pcap"
+run store_history   store_history   HBTAD_STORE=store HBTAD_TRAIN=100 -- "$data/tap2.pcap"
+sums store_files    store model
+
+if [ $update = 1 ]; then
+    echo "golden files updated"
+    exit 0
+fi
+
+echo "$passed passed, $failed failed"
+[ $failed = 0 ]
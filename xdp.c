@@ -0,0 +1,242 @@
+/*
+ * Loader and reader for the in-kernel aggregation, see xdp.h.
+ *
+ * No pcap in here, the capture loop that feeds the windows is xdp_live()
+ * in hbtad.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdp.h"
+
+#ifdef HAVE_LIBBPF
+
+#include <errno.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "bins.h"
+#include "addr.h"
+
+#define XDP_HIST_LEN (sizeof(struct xdp_hist)/sizeof(__u32))
+
+static struct bpf_object *xdp_obj;
+static unsigned int xdp_ifindex;
+static int xdp_flags;
+static int xdp_hist_fd, xdp_count_fd;
+
+// per-cpu values read back, and the sums at the last read
+static int xdp_ncpus;
+static struct xdp_hist *xdp_percpu;
+static struct xdp_hist xdp_prev;
+static struct xdp_counters xdp_prev_n;
+
+static int map_fd(const char *name)
+{
+    int fd = bpf_object__find_map_fd_by_name(xdp_obj, name);
+
+    if (fd < 0)
+        fprintf(stderr, "ERROR! xdp: no map %s in the program\n", name);
+    return fd;
+}
+
+// hand the binnings to the program as lookup tables
+static int xdp_tables(void)
+{
+    struct xdp_config cfg = { addr_bins.names != NULL };
+    struct xdp_lpm_key key;
+    uint32_t i, v;
+    int size_fd, port_fd, addr_fd, cfg_fd;
+
+    if ((size_fd = map_fd("size_bin")) < 0 || (port_fd = map_fd("port_bin")) < 0
+        || (addr_fd = map_fd("addr_bin")) < 0 || (cfg_fd = map_fd("config")) < 0)
+        return -1;
+
+    for (i = 0; i < XDP_SIZE_RANGE; i++)
+    {
+        v = bin_lookup(&size_bins, i);
+        if (bpf_map_update_elem(size_fd, &i, &v, BPF_ANY) != 0)
+            goto fail;
+    }
+
+    for (i = 0; i < XDP_PORT_RANGE; i++)
+    {
+        v = bin_lookup(&port_bins, i);
+        if (bpf_map_update_elem(port_fd, &i, &v, BPF_ANY) != 0)
+            goto fail;
+    }
+
+    for (i = 0; cfg.addr_groups && i < (uint32_t)addr_bins.lpm.nrules; i++)
+    {
+        key.prefixlen = addr_bins.lpm.rules[i].len;
+        key.addr = htonl(addr_bins.lpm.rules[i].prefix);
+        v = addr_bins.lpm.rules[i].value;
+        if (bpf_map_update_elem(addr_fd, &key, &v, BPF_ANY) != 0)
+            goto fail;
+    }
+
+    i = 0;
+    if (bpf_map_update_elem(cfg_fd, &i, &cfg, BPF_ANY) != 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    fprintf(stderr, "ERROR! xdp: unable to fill the lookup tables: %s\n", strerror(errno));
+    return -1;
+}
+
+int xdp_open(const char *dev, const char *obj, const char *mode)
+{
+    struct bpf_program *prog;
+
+    if ((xdp_ifindex = if_nametoindex(dev)) == 0)
+    {
+        fprintf(stderr, "ERROR! xdp: no interface %s\n", dev);
+        return -1;
+    }
+
+    if (mode && strcmp(mode, "skb") == 0)
+        xdp_flags = XDP_FLAGS_SKB_MODE;
+    else if (mode && strcmp(mode, "drv") == 0)
+        xdp_flags = XDP_FLAGS_DRV_MODE;
+    else if (mode)
+    {
+        fprintf(stderr, "ERROR! xdp: unknown mode '%s'\n", mode);
+        return -1;
+    }
+
+    if (!obj)
+        obj = XDP_OBJ_PATH;
+
+    if ((xdp_obj = bpf_object__open_file(obj, NULL)) == NULL || bpf_object__load(xdp_obj) != 0)
+    {
+        fprintf(stderr, "ERROR! xdp: unable to load %s: %s\n", obj, strerror(errno));
+        goto fail;
+    }
+
+    if ((prog = bpf_object__find_program_by_name(xdp_obj, XDP_PROG_NAME)) == NULL)
+    {
+        fprintf(stderr, "ERROR! xdp: no program %s in %s\n", XDP_PROG_NAME, obj);
+        goto fail;
+    }
+
+    if ((xdp_hist_fd = map_fd("hist")) < 0 || (xdp_count_fd = map_fd("counters")) < 0
+        || xdp_tables() != 0)
+        goto fail;
+
+    if ((xdp_ncpus = libbpf_num_possible_cpus()) <= 0)
+    {
+        fprintf(stderr, "ERROR! xdp: unable to count cpus\n");
+        goto fail;
+    }
+
+    if ((xdp_percpu = malloc(xdp_ncpus*sizeof(*xdp_percpu))) == NULL)
+    {
+        fprintf(stderr, "ERROR! xdp: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&xdp_prev, 0, sizeof(xdp_prev));
+    memset(&xdp_prev_n, 0, sizeof(xdp_prev_n));
+
+    if (bpf_xdp_attach(xdp_ifindex, bpf_program__fd(prog), xdp_flags, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR! xdp: unable to attach to %s: %s\n", dev, strerror(errno));
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    free(xdp_percpu);
+    xdp_percpu = NULL;
+    bpf_object__close(xdp_obj);
+    xdp_obj = NULL;
+    return -1;
+}
+
+/*
+ * the sums are uint32 like the counters, so a counter that wrapped
+ * still gives the right difference
+ */
+int xdp_read(struct xdp_hist *delta, struct xdp_counters *counters)
+{
+    struct xdp_counters *c = (struct xdp_counters *)xdp_percpu;
+    __u32 *dst = (__u32 *)delta, *prev = (__u32 *)&xdp_prev, *src, sum, key = 0;
+    int cpu, i;
+
+    if (bpf_map_lookup_elem(xdp_hist_fd, &key, xdp_percpu) != 0)
+        goto fail;
+
+    memset(delta, 0, sizeof(*delta));
+    for (cpu = 0; cpu < xdp_ncpus; cpu++)
+    {
+        src = (__u32 *)&xdp_percpu[cpu];
+        for (i = 0; i < (int)XDP_HIST_LEN; i++)
+            dst[i] += src[i];
+    }
+
+    for (i = 0; i < (int)XDP_HIST_LEN; i++)
+    {
+        sum = dst[i];
+        dst[i] = sum - prev[i];
+        prev[i] = sum;
+    }
+
+    // the per-cpu buffer has room for the counters too
+    if (bpf_map_lookup_elem(xdp_count_fd, &key, c) != 0)
+        goto fail;
+
+    memset(counters, 0, sizeof(*counters));
+    for (cpu = 0; cpu < xdp_ncpus; cpu++)
+        for (i = 0; i < XDP_NUM_COUNTERS; i++)
+            counters->n[i] += c[cpu].n[i];
+
+    for (i = 0; i < XDP_NUM_COUNTERS; i++)
+    {
+        counters->n[i] -= xdp_prev_n.n[i];
+        xdp_prev_n.n[i] += counters->n[i];
+    }
+
+    return 0;
+
+fail:
+    fprintf(stderr, "ERROR! xdp: unable to read the maps: %s\n", strerror(errno));
+    return -1;
+}
+
+void xdp_close(void)
+{
+    if (!xdp_obj)
+        return;
+
+    bpf_xdp_detach(xdp_ifindex, xdp_flags, NULL);
+    bpf_object__close(xdp_obj);
+    free(xdp_percpu);
+    xdp_obj = NULL;
+    xdp_percpu = NULL;
+}
+
+#else
+
+int xdp_open(const char *dev, const char *obj, const char *mode)
+{
+    fprintf(stderr, "ERROR! xdp: built without libbpf, rebuild with make HAVE_LIBBPF=1\n");
+    return -1;
+}
+
+int xdp_read(struct xdp_hist *delta, struct xdp_counters *counters)
+{
+    return -1;
+}
+
+void xdp_close(void)
+{
+}
+
+#endif
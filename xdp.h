@@ -0,0 +1,90 @@
+#ifndef XDP_H
+#define XDP_H
+
+/*
+ * In-kernel feature aggregation for live capture.
+ *
+ * An XDP program (xdp_kern.c, built into hbtad_xdp.o) parses every packet
+ * on the interface the same way parse_packet() does and counts it into a
+ * per-cpu copy of the window histograms, so no packet is ever copied to
+ * user space.  It always passes the packet on.
+ *
+ * The kernel counters are never reset.  Once a second hbtad sums the cpu
+ * copies and feeds the difference to the previous sum into the histograms
+ * with hist_add_counts(), then closes windows as usual.  With no reset
+ * there is no race against packets being counted while the maps are read,
+ * and 32 bit counters wrapping is harmless as long as no cpu counts 2^32
+ * of one bin in a second.
+ *
+ * The binnings are handed to the program as lookup tables: one entry per
+ * packet size and per port, and an LPM trie of the address prefix groups.
+ *
+ * Only this header is shared with the BPF side, it needs nothing but the
+ * kernel's types.
+ */
+
+#include <linux/types.h>
+
+// layout of struct hist, checked against it in xdp.c
+#define XDP_SNAP_LEN 1518
+
+struct xdp_hist {
+    __u32 src_ip_addrs[256];
+    __u32 dst_ip_addrs[256];
+    __u32 src_ports[1024];
+    __u32 dst_ports[1024];
+    __u32 protocols[4];
+    __u32 packet_sizes[XDP_SNAP_LEN];
+    __u32 flags[256];
+};
+
+// parse results, the same as the stats counters
+enum xdp_counter {
+    XDP_PACKETS,
+    XDP_INVALID_IP,
+    XDP_INVALID_TCP,
+    XDP_OVERSIZED,
+    XDP_NUM_COUNTERS
+};
+
+struct xdp_counters {
+    __u64 n[XDP_NUM_COUNTERS];
+};
+
+struct xdp_config {
+    __u32 addr_groups;      // look addresses up in addr_bin, else last octet
+};
+
+// size_bin covers every size an ip packet can have
+#define XDP_SIZE_RANGE 65536
+#define XDP_PORT_RANGE 1024
+#define XDP_MAX_PREFIXES 65536
+
+struct xdp_lpm_key {
+    __u32 prefixlen;
+    __u32 addr;             // network order
+};
+
+// program and object the loader looks for
+#define XDP_PROG_NAME "hbtad_xdp"
+#define XDP_OBJ_PATH "hbtad_xdp.o"
+
+#ifndef __bpf__
+/*
+ * user space side, kept apart from pcap.h, whose struct bpf_insn clashes
+ * with the kernel's
+ */
+
+// load the program, fill in the binnings and attach it to dev.  obj is
+// the compiled program (NULL for XDP_OBJ_PATH), mode "skb", "drv" or NULL
+// to let the kernel pick.  0 on success
+int xdp_open(const char *dev, const char *obj, const char *mode);
+
+// what was counted since the last call, summed over all cpus
+int xdp_read(struct xdp_hist *delta, struct xdp_counters *counters);
+
+// detach and unload
+void xdp_close(void);
+#endif
+
+#endif
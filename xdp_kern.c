@@ -0,0 +1,203 @@
+/*
+ * XDP program counting packets into the window histograms, see xdp.h.
+ *
+ * clang -O2 -g -target bpf -c xdp_kern.c -o hbtad_xdp.o
+ *
+ * The parsing follows parse_packet() field for field, including reading
+ * the ports without byte swapping, so the kernel and the pcap path give
+ * the same histograms for the same traffic.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "xdp.h"
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_hist);
+} hist SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_counters);
+} counters SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_config);
+} config SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, XDP_SIZE_RANGE);
+    __type(key, __u32);
+    __type(value, __u32);
+} size_bin SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, XDP_PORT_RANGE);
+    __type(key, __u32);
+    __type(value, __u32);
+} port_bin SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, XDP_MAX_PREFIXES);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct xdp_lpm_key);
+    __type(value, __u32);
+} addr_bin SEC(".maps");
+
+static __always_inline __u32 table(void *map, __u32 key)
+{
+    __u32 *v = bpf_map_lookup_elem(map, &key);
+
+    return v ? *v : 0;
+}
+
+static __always_inline __u32 addr_bucket(const struct xdp_config *cfg, __u32 addr)
+{
+    struct xdp_lpm_key k = { 32, addr };
+    __u32 *v;
+
+    if (!cfg->addr_groups)
+        return bpf_ntohl(addr) & 0xff;
+
+    v = bpf_map_lookup_elem(&addr_bin, &k);
+    return v ? *v & 0xff : 0;
+}
+
+static __always_inline void count_size(struct xdp_hist *h, int size)
+{
+    __u32 b;
+
+    if (size < 0)
+        return;
+
+    b = table(&size_bin, size & (XDP_SIZE_RANGE - 1));
+    if (b < XDP_SNAP_LEN)
+        h->packet_sizes[b]++;
+}
+
+SEC("xdp")
+int hbtad_xdp(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = data;
+    struct iphdr *ip;
+    struct tcphdr *tcp;
+    struct xdp_hist *h;
+    struct xdp_counters *c;
+    struct xdp_config *cfg;
+    __u32 zero = 0, b;
+    __u16 sport, dport;
+    int size_ip, size_tcp, size;
+    __be16 proto;
+    void *l3;
+
+    // the pcap path only sees what the "ip or (vlan and ip)" filter lets
+    // through, see link_filter()
+    if ((void *)(eth + 1) > end)
+        return XDP_PASS;
+    proto = eth->h_proto;
+    l3 = eth + 1;
+    if (proto == bpf_htons(ETH_P_8021Q) || proto == bpf_htons(ETH_P_8021AD)
+        || proto == bpf_htons(ETH_P_QINQ1))
+    {
+        // tag control, then the tagged frame's type
+        if (l3 + 4 > end)
+            return XDP_PASS;
+        proto = *(__be16 *)(l3 + 2);
+        l3 += 4;
+    }
+    if (proto != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+
+    ip = l3;
+    if ((void *)(ip + 1) > end)
+        return XDP_PASS;
+
+    h = bpf_map_lookup_elem(&hist, &zero);
+    c = bpf_map_lookup_elem(&counters, &zero);
+    cfg = bpf_map_lookup_elem(&config, &zero);
+    if (!h || !c || !cfg)
+        return XDP_PASS;
+
+    c->n[XDP_PACKETS]++;
+
+    size_ip = (*(__u8 *)ip & 0x0f)*4;
+    if (size_ip < 20)
+    {
+        c->n[XDP_INVALID_IP]++;
+        return XDP_PASS;
+    }
+
+    h->src_ip_addrs[addr_bucket(cfg, ip->saddr)]++;
+    h->dst_ip_addrs[addr_bucket(cfg, ip->daddr)]++;
+
+    switch (ip->protocol)
+    {
+        case IPPROTO_TCP:
+            h->protocols[0]++;
+            break;
+        case IPPROTO_UDP:
+            h->protocols[1]++;
+            count_size(h, ETH_HLEN + size_ip);
+            return XDP_PASS;
+        case IPPROTO_ICMP:
+            h->protocols[2]++;
+            count_size(h, ETH_HLEN + size_ip);
+            return XDP_PASS;
+        case IPPROTO_IP:
+            h->protocols[3]++;
+            count_size(h, ETH_HLEN + size_ip);
+            return XDP_PASS;
+        default:
+            count_size(h, ETH_HLEN + size_ip);
+            return XDP_PASS;
+    }
+
+    tcp = (void *)ip + size_ip;
+    if ((void *)(tcp + 1) > end)
+        return XDP_PASS;
+
+    size_tcp = tcp->doff*4;
+    if (size_tcp < 20)
+    {
+        c->n[XDP_INVALID_TCP]++;
+        return XDP_PASS;
+    }
+
+    h->flags[((__u8 *)tcp)[13]]++;
+
+    // compared in network order, as parse_packet() does
+    sport = tcp->source;
+    dport = tcp->dest;
+    if (sport < XDP_PORT_RANGE && (b = table(&port_bin, sport)) < XDP_PORT_RANGE)
+        h->src_ports[b]++;
+    if (dport < XDP_PORT_RANGE && (b = table(&port_bin, dport)) < XDP_PORT_RANGE)
+        h->dst_ports[b]++;
+
+    size = bpf_ntohs(ip->tot_len) - (size_ip + size_tcp);
+    count_size(h, size);
+    if (size + ETH_HLEN + size_ip >= XDP_SNAP_LEN)
+        c->n[XDP_OVERSIZED]++;
+
+    return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,422 @@
+/*
+ * Compressed capture input, see zfile.h.
+ */
+
+#define _GNU_SOURCE             // fopencookie()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "zfile.h"
+
+#define ZFILE_MASK (ZFILE_BUFS - 1)
+
+// compressed bytes read at a time
+#define ZFILE_IN_SIZE (1 << 17)
+
+struct zbuf {
+    unsigned char *data;
+    size_t len;
+};
+
+struct zfile {
+    const char *path;
+    FILE *fp;
+    enum zfile_format format;
+    unsigned char *in;
+    pthread_t thread;
+    // head is only written by the decompression thread, tail by the reader
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    atomic_int done;            // 1 at the end of the input, -1 on errors
+    atomic_int stop;            // the reader has gone
+    size_t pos;                 // read position in the tail buffer
+    struct zbuf bufs[ZFILE_BUFS];
+};
+
+enum zfile_format zfile_format(const char *path)
+{
+    unsigned char m[4];
+    FILE *fp;
+    size_t n;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return ZFILE_NONE;
+    n = fread(m, 1, sizeof(m), fp);
+    fclose(fp);
+
+    if (n >= 2 && m[0] == 0x1f && m[1] == 0x8b)
+        return ZFILE_GZIP;
+    if (n == 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd)
+        return ZFILE_ZSTD;
+    if (n == 4 && m[0] == 0x04 && m[1] == 0x22 && m[2] == 0x4d && m[3] == 0x18)
+        return ZFILE_LZ4;
+    return ZFILE_NONE;
+}
+
+// the next free buffer, waits for the reader to make room, NULL once it is
+// gone
+static unsigned char *zf_get(struct zfile *z)
+{
+    unsigned int head = atomic_load_explicit(&z->head, memory_order_relaxed);
+
+    while (head - atomic_load_explicit(&z->tail, memory_order_acquire) == ZFILE_BUFS)
+    {
+        if (atomic_load_explicit(&z->stop, memory_order_relaxed))
+            return NULL;
+        usleep(100);
+    }
+
+    return atomic_load_explicit(&z->stop, memory_order_relaxed) ? NULL
+        : z->bufs[head & ZFILE_MASK].data;
+}
+
+// hand the buffer from zf_get() with len bytes in it to the reader
+static void zf_put(struct zfile *z, size_t len)
+{
+    unsigned int head = atomic_load_explicit(&z->head, memory_order_relaxed);
+
+    if (len == 0)
+        return;
+
+    z->bufs[head & ZFILE_MASK].len = len;
+    atomic_store_explicit(&z->head, head + 1, memory_order_release);
+}
+
+// more compressed input, 0 at the end of the file
+static size_t zf_fill(struct zfile *z)
+{
+    size_t n = fread(z->in, 1, ZFILE_IN_SIZE, z->fp);
+
+    if (n == 0 && ferror(z->fp))
+        fprintf(stderr, "ERROR! zfile: unable to read %s\n", z->path);
+    return n;
+}
+
+static void zf_cut_off(struct zfile *z)
+{
+    fprintf(stderr, "warning: %s: compressed stream cut off\n", z->path);
+}
+
+static int gz_run(struct zfile *z)
+{
+    z_stream s;
+    unsigned char *out;
+    int ret, mid = 0;
+
+    memset(&s, 0, sizeof(s));
+    if (inflateInit2(&s, 15 + 16) != Z_OK)
+    {
+        fprintf(stderr, "ERROR! zfile: unable to set up zlib\n");
+        return -1;
+    }
+
+    while ((out = zf_get(z)) != NULL)
+    {
+        s.next_out = out;
+        s.avail_out = ZFILE_BUF_SIZE;
+
+        while (s.avail_out > 0)
+        {
+            if (s.avail_in == 0)
+            {
+                if ((s.avail_in = zf_fill(z)) == 0)
+                    break;
+                s.next_in = z->in;
+            }
+
+            ret = inflate(&s, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END)
+            {
+                // another member may follow
+                inflateReset(&s);
+                mid = 0;
+            }
+            else if (ret == Z_OK || ret == Z_BUF_ERROR)
+                mid = 1;
+            else
+            {
+                fprintf(stderr, "ERROR! zfile: %s: %s\n", z->path, s.msg ? s.msg : "bad data");
+                inflateEnd(&s);
+                return -1;
+            }
+        }
+
+        zf_put(z, ZFILE_BUF_SIZE - s.avail_out);
+        if (s.avail_out > 0)
+            break;
+    }
+
+    inflateEnd(&s);
+    if (out && mid)
+        zf_cut_off(z);
+    return ferror(z->fp) ? -1 : 0;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_run(struct zfile *z)
+{
+    ZSTD_DStream *ds;
+    ZSTD_inBuffer in = { z->in, 0, 0 };
+    ZSTD_outBuffer out;
+    unsigned char *buf;
+    size_t ret = 0;
+
+    if ((ds = ZSTD_createDStream()) == NULL)
+    {
+        fprintf(stderr, "ERROR! zfile: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    ZSTD_initDStream(ds);
+
+    while ((buf = zf_get(z)) != NULL)
+    {
+        out.dst = buf;
+        out.size = ZFILE_BUF_SIZE;
+        out.pos = 0;
+
+        while (out.pos < out.size)
+        {
+            if (in.pos == in.size)
+            {
+                if ((in.size = zf_fill(z)) == 0)
+                    break;
+                in.pos = 0;
+            }
+
+            // carries on with the next frame after one ends
+            ret = ZSTD_decompressStream(ds, &out, &in);
+            if (ZSTD_isError(ret))
+            {
+                fprintf(stderr, "ERROR! zfile: %s: %s\n", z->path, ZSTD_getErrorName(ret));
+                ZSTD_freeDStream(ds);
+                return -1;
+            }
+        }
+
+        zf_put(z, out.pos);
+        if (out.pos < out.size)
+            break;
+    }
+
+    ZSTD_freeDStream(ds);
+    if (buf && ret != 0)
+        zf_cut_off(z);
+    return ferror(z->fp) ? -1 : 0;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static int lz4_run(struct zfile *z)
+{
+    LZ4F_dctx *dc;
+    unsigned char *buf;
+    size_t in_len = 0, in_pos = 0, out_pos, src, dst, ret = 0;
+
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dc, LZ4F_VERSION)))
+    {
+        fprintf(stderr, "ERROR! zfile: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((buf = zf_get(z)) != NULL)
+    {
+        out_pos = 0;
+
+        while (out_pos < ZFILE_BUF_SIZE)
+        {
+            if (in_pos == in_len)
+            {
+                if ((in_len = zf_fill(z)) == 0)
+                    break;
+                in_pos = 0;
+            }
+
+            // ready for the next frame once one is done
+            src = in_len - in_pos;
+            dst = ZFILE_BUF_SIZE - out_pos;
+            ret = LZ4F_decompress(dc, buf + out_pos, &dst, z->in + in_pos, &src, NULL);
+            if (LZ4F_isError(ret))
+            {
+                fprintf(stderr, "ERROR! zfile: %s: %s\n", z->path, LZ4F_getErrorName(ret));
+                LZ4F_freeDecompressionContext(dc);
+                return -1;
+            }
+            in_pos += src;
+            out_pos += dst;
+        }
+
+        zf_put(z, out_pos);
+        if (out_pos < ZFILE_BUF_SIZE)
+            break;
+    }
+
+    LZ4F_freeDecompressionContext(dc);
+    if (buf && ret != 0)
+        zf_cut_off(z);
+    return ferror(z->fp) ? -1 : 0;
+}
+#endif
+
+static void *zf_thread(void *arg)
+{
+    struct zfile *z = arg;
+    int ret = -1;
+
+    switch (z->format)
+    {
+        case ZFILE_GZIP:
+            ret = gz_run(z);
+            break;
+#ifdef HAVE_ZSTD
+        case ZFILE_ZSTD:
+            ret = zstd_run(z);
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case ZFILE_LZ4:
+            ret = lz4_run(z);
+            break;
+#endif
+        default:
+            break;
+    }
+
+    atomic_store_explicit(&z->done, ret == 0 ? 1 : -1, memory_order_release);
+    return NULL;
+}
+
+static ssize_t zf_read(void *cookie, char *buf, size_t size)
+{
+    struct zfile *z = cookie;
+    unsigned int tail = atomic_load_explicit(&z->tail, memory_order_relaxed);
+    struct zbuf *b;
+    size_t n;
+    int done;
+
+    while (atomic_load_explicit(&z->head, memory_order_acquire) == tail)
+    {
+        // check head again, the last buffer may have come in with done
+        done = atomic_load_explicit(&z->done, memory_order_acquire);
+        if (done && atomic_load_explicit(&z->head, memory_order_acquire) == tail)
+            return done < 0 ? -1 : 0;
+        usleep(100);
+    }
+
+    b = &z->bufs[tail & ZFILE_MASK];
+    n = b->len - z->pos < size ? b->len - z->pos : size;
+    memcpy(buf, b->data + z->pos, n);
+
+    if ((z->pos += n) == b->len)
+    {
+        z->pos = 0;
+        atomic_store_explicit(&z->tail, tail + 1, memory_order_release);
+    }
+
+    return n;
+}
+
+static int zf_close(void *cookie)
+{
+    struct zfile *z = cookie;
+    int i;
+
+    atomic_store_explicit(&z->stop, 1, memory_order_relaxed);
+    pthread_join(z->thread, NULL);
+
+    for (i = 0; i < ZFILE_BUFS; i++)
+        free(z->bufs[i].data);
+    free(z->in);
+    fclose(z->fp);
+    free(z);
+
+    return 0;
+}
+
+FILE *zfile_open(const char *path)
+{
+    cookie_io_functions_t io = { zf_read, NULL, NULL, zf_close };
+    struct zfile *z;
+    FILE *fp;
+    int i;
+
+    if ((z = calloc(1, sizeof(*z))) == NULL)
+    {
+        fprintf(stderr, "ERROR! zfile: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    z->path = path;
+    z->format = zfile_format(path);
+#ifndef HAVE_ZSTD
+    if (z->format == ZFILE_ZSTD)
+    {
+        fprintf(stderr, "ERROR! zfile: %s: built without zstd, rebuild with make HAVE_ZSTD=1\n", path);
+        goto fail;
+    }
+#endif
+#ifndef HAVE_LZ4
+    if (z->format == ZFILE_LZ4)
+    {
+        fprintf(stderr, "ERROR! zfile: %s: built without lz4, rebuild with make HAVE_LZ4=1\n", path);
+        goto fail;
+    }
+#endif
+    if (z->format == ZFILE_NONE)
+    {
+        fprintf(stderr, "ERROR! zfile: %s is not compressed\n", path);
+        goto fail;
+    }
+
+    if ((z->fp = fopen(path, "rb")) == NULL)
+    {
+        fprintf(stderr, "ERROR! zfile: unable to open %s\n", path);
+        goto fail;
+    }
+
+    z->in = malloc(ZFILE_IN_SIZE);
+    for (i = 0; i < ZFILE_BUFS; i++)
+        z->bufs[i].data = malloc(ZFILE_BUF_SIZE);
+    for (i = 0; i < ZFILE_BUFS && z->in; i++)
+        if (!z->bufs[i].data)
+            break;
+    if (!z->in || i < ZFILE_BUFS)
+    {
+        fprintf(stderr, "ERROR! zfile: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&z->thread, NULL, zf_thread, z) != 0)
+    {
+        fprintf(stderr, "ERROR! zfile: unable to create decompression thread\n");
+        for (i = 0; i < ZFILE_BUFS; i++)
+            free(z->bufs[i].data);
+        free(z->in);
+        fclose(z->fp);
+        goto fail;
+    }
+
+    if ((fp = fopencookie(z, "r", io)) == NULL)
+    {
+        fprintf(stderr, "ERROR! zfile: unable to open a stream for %s\n", path);
+        zf_close(z);
+        return NULL;
+    }
+
+    return fp;
+
+fail:
+    free(z);
+    return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef ZFILE_H
+#define ZFILE_H
+
+/*
+ * Compressed capture input.
+ *
+ * zfile_open() gives a FILE that reads the decompressed file, for
+ * pcap_fopen_offline().  Nothing is written to disk.  A thread of its own
+ * decompresses into a ring of ZFILE_BUFS fixed-size buffers, and the
+ * reader takes them from the other end.  Decompression and parsing then
+ * run side by side and the slower of the two sets the pace.  The ring is
+ * single producer/single consumer like the output ring.
+ *
+ * The format is told by the magic number, not the file name: gzip (zlib,
+ * always built in), zstd with make HAVE_ZSTD=1 and lz4 frames with make
+ * HAVE_LZ4=1.  Concatenated gzip members and zstd/lz4 frames are read
+ * one after the other.  A stream cut off at the end ends the read with a
+ * warning, like a short pcap file.
+ */
+
+#include <stdio.h>
+
+// bytes per buffer, and buffers in the ring (a power of 2)
+#define ZFILE_BUF_SIZE (1 << 20)
+#define ZFILE_BUFS 8
+
+enum zfile_format {
+    ZFILE_NONE,
+    ZFILE_GZIP,
+    ZFILE_ZSTD,
+    ZFILE_LZ4
+};
+
+// which compression path is in, ZFILE_NONE if none or it can't be read
+enum zfile_format zfile_format(const char *path);
+
+// open path for reading decompressed, NULL on errors.  fclose() stops the
+// decompression thread
+FILE *zfile_open(const char *path);
+
+#endif